@@ -15,43 +15,609 @@
 #include <SPI.h>
 #include <SD.h>
 #include <ArduinoJson.h>
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+#include <atomic>
+#include <cmath>
 
 #define SD_SPI_SCK_PIN  (40)
 #define SD_SPI_MISO_PIN (39)
 #define SD_SPI_MOSI_PIN (14)
 #define SD_SPI_CS_PIN   (12)
 
+// SD clocks tried at boot, fastest first. The card is on GPIO-matrix pins
+// rather than the SPI host's IOMUX pins, so how fast reads stay reliable
+// depends on the card; beginSD() keeps the first clock that reads sector 0
+// back identically sd_probe_reads times with a valid boot signature.
+static constexpr const uint32_t sd_probe_clocks[] = {40000000, 26666666, 20000000, 16000000, 10000000};
+static constexpr const uint32_t sd_fallback_clock = 4000000;
+static constexpr const int sd_probe_reads = 4;
+static uint32_t sd_clock_hz = 0;  // Clock the card was mounted at
+
 // Voice input recording: 2 seconds at 16kHz = 32,000 samples
-// At 240 samples per chunk = 134 chunks (~64KB buffer)
+// At 240 samples per chunk = 134 chunks, analysed as they arrive so only a
+// small ring of chunks (~4KB) is kept for the waveform display
 static constexpr const size_t record_number     = 134;  // Reduced from 512 for voice mode
 static constexpr const size_t record_length     = 240;
 static constexpr const size_t record_size       = record_number * record_length;
 static constexpr const size_t record_samplerate = 16000;
-
-static int16_t prev_y[record_length];
-static int16_t prev_h[record_length];
-static size_t rec_record_idx  = 2;
-static size_t draw_record_idx = 0;
+static constexpr const size_t rec_ring_chunks   = 8;    // 2 queued in the mic + 2 drawn, with room for a slow frame
+static constexpr const size_t rec_ring_size     = rec_ring_chunks * record_length;
+
+static int16_t prev_y[record_length];  // Envelope span drawn last frame, per column,
+static int16_t prev_h[record_length];  // so only the previous trace is erased
+static size_t rec_record_idx   = 0;  // Next chunk to hand to the mic
+static size_t rec_analyze_idx  = 0;  // Next filled chunk to fold into voice_features
+static size_t draw_record_idx  = 0;  // Newest filled chunk the UI has been told about
 static int16_t* rec_data;
 
+// Voice activity detection: recording stops after trailing silence instead of
+// always running the full record_number chunks. Durations are in chunks of
+// record_length samples (15ms at 16kHz).
+static constexpr const size_t record_chunk_ms   = record_length * 1000 / record_samplerate;
+static constexpr const bool     vad_enabled          = true;
+static constexpr const bool     vad_wait_for_onset   = true;   // Don't start the clock until speech begins
+static constexpr const size_t   vad_onset_timeout    = 3000 / record_chunk_ms;  // Give up waiting after 3s
+static constexpr const size_t   vad_trailing_silence = 450 / record_chunk_ms;   // Silence that ends a question
+static constexpr const size_t   vad_min_speech       = 150 / record_chunk_ms;   // Ignore clicks and bumps
+static constexpr const uint32_t vad_min_energy       = 300 * 300;  // Mean square floor (RMS ~300)
+static constexpr const uint32_t vad_noise_ratio      = 4;          // Speech must be this far above the noise floor
+
+struct VoiceActivity {
+    uint32_t noise_floor = 0;   // Mean square energy of non-speech chunks
+    size_t onset_chunk = 0;     // Chunk where speech started
+    size_t speech_chunks = 0;
+    size_t silent_chunks = 0;   // Consecutive non-speech chunks since the last speech
+    bool speech_started = false;
+};
+static VoiceActivity voice_activity;
+static size_t rec_chunk_limit = record_number;  // Chunks to capture, lowered by VAD
+
+// Response audio playback: clips are streamed from SD in fixed-size chunks
+// through rotating buffers (one playing, one queued, one being filled)
+static constexpr const size_t play_chunk_samples = 1024;
+static constexpr const size_t play_buffer_count  = 3;
+static constexpr const uint8_t play_channel      = 0;
+static int16_t* play_buffers[play_buffer_count];
+
+// Clips that aren't already 16-bit mono at record_samplerate are converted
+// as they stream: IMA-ADPCM is decoded, stereo averaged, 8-bit widened, and
+// the rate changed by linear interpolation on a 16.16 fixed-point phase.
+// Source bytes go through wav_raw, shared like play_buffers since only one
+// response clip streams at a time (the ambient loop has its own); an ADPCM
+// block has to fit in it whole.
+static constexpr const size_t wav_raw_bytes = 2048;  // Whole frames at 1, 2 or 4 bytes each
+alignas(4) static uint8_t wav_raw[wav_raw_bytes];
+static constexpr const uint16_t wave_format_pcm = 0x0001;
+static constexpr const uint16_t wave_format_ima_adpcm = 0x0011;
+
+struct WavConverter {
+    bool active = false;      // False when samples are read straight into the buffers
+    uint16_t format = wave_format_pcm;
+    uint8_t channels = 1;
+    uint8_t bits = 16;
+    uint16_t block_align = 0;    // IMA-ADPCM bytes per block
+    uint16_t block_frames = 0;   // Frames in the block in wav_raw
+    uint16_t block_frame = 0;    // Next of them to decode
+    int32_t predictor[2] = {0, 0};  // IMA-ADPCM decoder state per channel
+    uint8_t step_index[2] = {0, 0};
+    uint32_t step = 0x10000;  // Source frames per output sample, 16.16
+    uint32_t phase = 0;       // Output position past frame a, 16.16
+    int32_t a = 0;            // Source frames either side of the output position
+    int32_t b = 0;
+    const uint8_t* raw = wav_raw;  // Source bytes being consumed, buffer or memory
+    uint8_t* buffer = wav_raw;     // wav_raw_bytes the file is read into
+    size_t raw_pos = 0;
+    size_t raw_len = 0;
+    size_t file_remaining = 0;  // Source bytes not yet read
+    const uint8_t* memory = nullptr;  // Encoded clip held by the asset cache, read instead of the file
+    uint8_t* copy_to = nullptr;       // Cache entry receiving the encoded bytes as they are read
+    size_t copied = 0;
+};
+
+// Off-screen frame: every screen is composed here and pushed to the panel in
+// a single transfer instead of clearing and redrawing the panel directly
+static M5Canvas frame(&M5Cardputer.Display);
+static bool frame_dma = true;  // 16bpp frame, pushed by DMA as-is
+
+// BMP images are decoded straight from SD into the frame, a few rows at a
+// time, so the whole file is never held in RAM
+static constexpr const size_t bmp_chunk_bytes = 4096;
+alignas(4) static uint8_t bmp_chunk[bmp_chunk_bytes];
+
+struct BmpInfo {
+    int32_t width = 0;
+    int32_t height = 0;       // Always positive, see top_down
+    uint16_t bpp = 0;         // 16 or 24
+    bool top_down = false;    // Negative height in the file
+    bool rgb555 = false;      // 16bpp X1R5G5B5 rather than R5G6B5
+    uint32_t data_offset = 0;
+    uint32_t row_stride = 0;  // Rows are padded to 4 bytes
+};
+
+// Voice input waveform meter: a small 8bpp sprite holding a min/max envelope
+// of the newest recorded chunks, pushed on its own so the rest of the screen
+// is left alone while recording
+static constexpr const int wave_y = 48;
+static constexpr const int wave_height = 80;
+static constexpr const size_t wave_window_chunks = 2;  // Filled chunks still safe to read in the ring
+static M5Canvas wave_sprite(&M5Cardputer.Display);
+
+// Response audio playback job, serviced from loop() so the UI keeps running
+struct AudioPlayback {
+    File file;
+    size_t remaining = 0;  // Bytes of sample data not yet queued
+    size_t buf_idx = 0;
+    size_t ready = 0;      // Leading buffers already filled by the prefetch
+    WavConverter convert;
+    const int16_t* source = nullptr;  // Cached samples, played without SD reads
+    int16_t* fill = nullptr;          // Cache entry being filled as the clip streams
+    size_t filled = 0;
+    uint16_t idx = 0;
+    bool active = false;
+};
+static AudioPlayback playback;
+
+// The answer is chosen before THINKING starts, so its assets are opened and
+// pre-read there, one SD read per idle poll, while the animation runs.
+// Small bitmaps fit in bmp_prefetch whole; larger ones finish from SD.
+enum PrefetchStep { PREFETCH_WAV_OPEN, PREFETCH_WAV_CHUNKS, PREFETCH_BMP_OPEN, PREFETCH_BMP_ROWS, PREFETCH_DONE };
+
+static constexpr const size_t bmp_prefetch_bytes = 12288;  // 64x64 at 24bpp
+alignas(4) static uint8_t bmp_prefetch[bmp_prefetch_bytes];
+
+struct AssetPrefetch {
+    uint16_t idx = 0;
+    PrefetchStep step = PREFETCH_DONE;
+    File wav_file;
+    size_t wav_remaining = 0;  // Output bytes still to play, as in AudioPlayback
+    size_t wav_ready = 0;      // Chunks read into play_buffers
+    WavConverter wav_convert;
+    File bmp_file;             // Open only if the bitmap parsed
+    BmpInfo bmp;
+    size_t bmp_rows = 0;       // Rows read into bmp_prefetch
+};
+static AssetPrefetch prefetch;
+
+// Mic capture, response playback and the prefetch run in audio_task, pinned
+// to core 0, while loop() keeps input and drawing on core 1. The two only
+// talk through these queues, so a slow redraw can't starve the mic or the
+// speaker and a slow SD read can't stall the UI. The capture state
+// (rec_record_idx, rec_analyze_idx, voice_features, voice_activity),
+// playback and prefetch belong to the audio task. The UI only touches the
+// prefetch and the asset cache after AUDIO_PREFETCH_DONE and before its
+// next command, and only reads recorded chunks for the waveform.
+static constexpr const BaseType_t audio_task_core = 0;  // loop() runs on core 1
+static constexpr const UBaseType_t audio_task_priority = 3;
+static constexpr const uint32_t audio_task_stack = 8192;
+static constexpr const uint32_t audio_service_ms = 5;  // Mic and speaker top-up interval while busy
+
+// Single-producer single-consumer ring: one task pushes, the other pops,
+// with no lock. A full queue refuses the push.
+template <typename T, size_t N>
+struct SpscQueue {
+    static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+    T items[N];
+    std::atomic<uint32_t> head{0};  // Next slot to pop, written by the consumer
+    std::atomic<uint32_t> tail{0};  // Next slot to push, written by the producer
+
+    bool push(const T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) return false;
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+enum AudioCommandType : uint8_t {
+    AUDIO_START_CAPTURE,    // Record a voice question
+    AUDIO_PREFETCH,         // Start pre-reading response idx
+    AUDIO_FINISH_PREFETCH,  // Complete the prefetch, answered by AUDIO_PREFETCH_DONE
+    AUDIO_PLAY,             // Play response idx's clip
+    AUDIO_STOP,             // Stop playback and drop the prefetch
+    AUDIO_POWER_DOWN,       // Shut the mic/speaker driver down for low-power IDLE
+};
+struct AudioCommand {
+    AudioCommandType type;
+    uint16_t idx;
+};
+
+enum AudioEventType : uint8_t {
+    AUDIO_CAPTURE_PROGRESS,  // value = progress percent, chunk = newest filled chunk
+    AUDIO_CAPTURE_DONE,      // value = seed from the voice features
+    AUDIO_PREFETCH_DONE,
+    AUDIO_PLAY_STARTED,      // value = 1 when playing from the cache
+    AUDIO_PLAY_FAILED,       // value = one of AudioFailure
+    AUDIO_PLAY_DONE,         // Sent once per AUDIO_PLAY that didn't get stopped
+};
+enum AudioFailure : uint8_t { AUDIO_FILE_NOT_FOUND, AUDIO_READ_FAILED };
+struct AudioEvent {
+    AudioEventType type;
+    uint16_t chunk;
+    uint32_t value;
+};
+
+static SpscQueue<AudioCommand, 8> audio_commands;  // loop() -> audio_task
+static SpscQueue<AudioEvent, 16> audio_events;     // audio_task -> loop()
+static TaskHandle_t audio_task = nullptr;
+static bool capture_active = false;  // Audio task side
+
+// UI side view of the audio task
+static uint8_t voice_progress = 0;
+static bool voice_capture_done = false;
+static uint32_t voice_seed = 0;
+static bool audio_busy = false;  // A clip was started and hasn't finished
+
+// The PDM mic's clock and the speaker's word select are both GPIO43, so
+// only one of them can drive I2S at a time and there is no full-duplex
+// mode on this board. audio_task keeps whichever was used last running and
+// switches ahead of need instead: to the speaker when THINKING starts on an
+// answer with audio, back to the mic when the answer is dismissed.
+enum AudioDevice : uint8_t { AUDIO_DEVICE_NONE, AUDIO_DEVICE_MIC, AUDIO_DEVICE_SPEAKER };
+static AudioDevice audio_device = AUDIO_DEVICE_NONE;  // audio_task only, after setup()
+
+// Input runs in input_task, a step above loop() on the same core, scanning
+// the keyboard and BtnA every input_scan_ms whatever loop() is drawing.
+// Each change becomes a timestamped InputEvent; loop() drains them
+// all at the top of every iteration, so a slow frame delays keys but never
+// merges or drops them.
+static constexpr const uint32_t input_scan_ms = 5;
+static constexpr const UBaseType_t input_task_priority = 2;  // loop() runs at 1
+static constexpr const uint32_t input_task_stack = 4096;
+
+enum InputEventType : uint8_t { INPUT_CHAR, INPUT_DELETE, INPUT_ENTER, INPUT_BUTTON, INPUT_OVERLAY, INPUT_DUMP };
+struct InputEvent {
+    InputEventType type;
+    char key;          // INPUT_CHAR only
+    uint32_t time_us;  // micros() when the scan saw it
+};
+static SpscQueue<InputEvent, 64> input_events;  // input_task -> loop()
+static TaskHandle_t loop_task = nullptr;         // Woken early by new input
+
+// Key-to-pixel latency: from the timestamp of the oldest keystroke not yet
+// on screen to the end of the push that shows it. Printed per question.
+struct InputLatency {
+    bool pending = false;
+    uint32_t pending_us = 0;
+    uint32_t count = 0;
+    uint64_t total_us = 0;
+    uint32_t max_us = 0;
+};
+static InputLatency key_latency;
+
+// Low-power IDLE. After idle_dim_ms without input the backlight dims and
+// the I2S driver shuts down (AUDIO_START_CAPTURE brings the mic back).
+// After idle_sleep_ms the backlight goes off and input_task light-sleeps
+// each scan interval instead of delaying, woken by the timer for the next
+// scan or at once by BtnA. The LEDC PWM behind the backlight stops in light
+// sleep, which is why sleeping waits for it to be off rather than dimmed.
+// Any input event returns to POWER_ACTIVE.
+enum PowerMode : uint8_t { POWER_ACTIVE, POWER_DIM, POWER_SLEEP };
+static std::atomic<PowerMode> power_mode{POWER_ACTIVE};  // Lowered by loop(), raised by input_task
+static constexpr const unsigned long idle_dim_ms = 15000;
+static constexpr const unsigned long idle_sleep_ms = 60000;
+static constexpr const uint8_t idle_dim_brightness = 24;
+static constexpr const uint32_t sleep_scan_ms = 20;          // Keys are seen at most this late
+static constexpr const uint16_t idle_power_poll_ms = 1000;   // loop() while dimmed or asleep
+static constexpr const gpio_num_t btn_a_gpio = GPIO_NUM_0;   // Active low
+static unsigned long last_input_time = 0;
+static uint8_t active_brightness = 0;  // Restored on wake
+static bool backlight_lowered = false;
+static bool wake_pending = false;      // The first event out of low power, until its screen is up
+static uint32_t wake_time_us = 0;
+
+// Scoped timers on the hot paths, read from the CPU cycle counter and
+// folded into count/min/max/total plus a histogram with buckets at 4x
+// steps: <4us, <16us, ... <16ms, and 16ms or more. Every task that times
+// anything (loop(), audio_task, catalog_task) writes only its own row, so
+// recording takes no lock even though audio_task and catalog_task share a
+// core; the overlay and dump add the rows up and may catch one
+// half-written record, which telemetry can live with.
+enum ProfilePoint : uint8_t {
+    PROF_SD_OPEN,         // openAssetFile()
+    PROF_SD_READ,         // Every asset read, with its bytes for throughput
+    PROF_WAV_READ,        // One play chunk read and converted
+    PROF_DISPLAY_ANSWER,  // displayAnswer(), bitmap decode included
+    PROF_MIC_RECORD,      // Mic.record() queueing a chunk
+    PROF_FRAME_PUSH,      // pushFrame()/pushFrameRegion(), counted for FPS
+    PROF_WAKE,            // Low-power IDLE to TEXT_INPUT/VOICE_INPUT on screen, from micros()
+    PROF_COUNT
+};
+static constexpr const char* profile_names[PROF_COUNT] = {"sd_open", "sd_read", "wav_read",
+                                                          "display_answer", "mic_record", "frame_push", "wake"};
+static constexpr const size_t profile_buckets = 8;
+enum ProfileRow : uint8_t { PROF_ROW_LOOP, PROF_ROW_AUDIO, PROF_ROW_CATALOG, PROF_ROW_COUNT };
+
+struct ProfileStat {
+    uint32_t count = 0;
+    uint32_t min_cycles = UINT32_MAX;
+    uint32_t max_cycles = 0;
+    uint64_t total_cycles = 0;
+    uint64_t bytes = 0;
+    uint32_t histogram[profile_buckets] = {};
+};
+static ProfileStat profile_stats[PROF_ROW_COUNT][PROF_COUNT];
+static uint32_t profile_cycles_per_us = 240;  // Set from the CPU clock in setup()
+
+void recordProfile(ProfilePoint point, uint32_t cycles, size_t bytes);
+struct ProfileScope {
+    ProfilePoint point;
+    uint32_t start;
+    size_t bytes = 0;  // Set by the caller for throughput
+    explicit ProfileScope(ProfilePoint p) : point(p), start(ESP.getCycleCount()) {}
+    ~ProfileScope() { recordProfile(point, ESP.getCycleCount() - start, bytes); }
+};
+
+// Hidden overlay (Ctrl+P) along the bottom of the panel. It is stamped into
+// frame's band just before a push that covers it and the pixels underneath
+// are put back by the next waitFramePush(), so screens never draw around it
+// and hiding it needs no repaint. Ctrl+D, or 'p' on Serial, dumps the stats.
+static constexpr const int overlay_height = 35;  // Four lines of Font0
+static constexpr const unsigned long overlay_refresh_ms = 500;
+
+struct ProfileOverlay {
+    bool visible = false;
+    bool stamped = false;      // frame's band holds the overlay, under holds what it covers
+    uint8_t* under = nullptr;  // Allocated while visible
+    unsigned long refreshed = 0;
+    uint32_t refreshed_pushes = 0;
+    char lines[4][48] = {};
+};
+static ProfileOverlay overlay;
+
+// LRU cache of decoded response assets, one slot per response index. Uses
+// PSRAM when the board has it; the Cardputer's StampS3 doesn't, so it
+// normally falls back to a small slice of internal RAM.
+static constexpr const size_t asset_cache_psram_budget = 2 * 1024 * 1024;
+static constexpr const size_t asset_cache_internal_budget = 48 * 1024;
+
+struct CachedAsset {
+    uint32_t last_used = 0;
+    int16_t* pcm = nullptr;       // Sample data after the WAV header
+    size_t pcm_bytes = 0;
+    bool pcm_ready = false;       // False while still being filled
+    uint16_t* pixels = nullptr;   // RGB565, top-down rows
+    size_t pixel_bytes = 0;
+    int16_t width = 0;
+    int16_t height = 0;
+    bool pixels_ready = false;
+};
+
+struct AssetCache {
+    std::vector<CachedAsset> entries;  // Indexed like responses
+    size_t budget = 0;
+    size_t used = 0;
+    uint32_t caps = MALLOC_CAP_8BIT;
+    uint32_t clock = 0;                // LRU age counter
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+};
+static AssetCache asset_cache;
+
+// The bitmap displayAnswer() draws, claimed beforehand by takeAnswerBitmap()
+struct AnswerBitmap {
+    File file;
+    BmpInfo info;
+    size_t ready_rows = 0;         // Rows the prefetch already read into bmp_prefetch
+    bool have = false;
+    bool from_cache = false;       // Decoded pixels are in cached
+    CachedAsset* cached = nullptr;
+    uint16_t* pixels = nullptr;    // Cache slot to decode into, if it fit
+};
+
+// Audio features used to seed randomness from voice input, accumulated in a
+// single pass so they can also be built up chunk by chunk
+struct AudioFeatures {
+    uint16_t peak = 0;           // Max absolute amplitude
+    uint16_t zero_crossings = 0; // Sign changes between consecutive samples
+    uint64_t sum_squares = 0;    // For RMS energy
+    size_t num_samples = 0;
+    int16_t last_sample = 0;     // Carried over for crossings at chunk boundaries
+};
+
+static AudioFeatures voice_features;
+
+// Catalog strings live in one arena, NUL-terminated and addressed by offset,
+// so the whole catalog is a single allocation (in PSRAM when present) rather
+// than three String blocks per response. Offset 0 is the empty string, and
+// paths are interned so responses sharing a clip or image share one copy.
+struct StringArena {
+    char* data = nullptr;
+    size_t size = 0;      // Bytes in use, including every NUL
+    size_t capacity = 0;
+};
+static StringArena catalog_strings;
+static std::vector<uint32_t> intern_slots;  // Open-addressed path offsets, kept only while loading JSON
+static size_t intern_count = 0;
+
+struct CatalogString {
+    uint32_t offset = 0;
+    uint16_t length = 0;
+    const char* c_str() const { return catalog_strings.data + offset; }
+    bool isEmpty() const { return length == 0; }
+};
+
 // Magic Eight Ball Response structure
 struct Response {
-    String text;
-    String wav_path;
-    String bitmap_path;
+    CatalogString text;
+    CatalogString wav_path;
+    CatalogString bitmap_path;
+    float weight = 1.0f;  // Relative chance of being picked, "weight" in responses.json
 };
 
 static std::vector<Response> responses;
+static constexpr const size_t max_responses = UINT16_MAX;
+
+// Walker alias table over the response weights, so a weighted pick is one
+// multiply, one compare and at most one extra lookup however large the
+// catalog is. Column i keeps itself when the seed's fraction is below
+// alias_threshold[i], otherwise it yields alias_index[i].
+static std::vector<uint32_t> alias_threshold;
+static std::vector<uint16_t> alias_index;
+
+// Binary catalog files share one layout. responses.idx is compiled from
+// responses.json on first boot and reused while the JSON's size and mtime
+// match, so boot normally skips JSON parsing and every asset's size and
+// format is already known. responses.pak (built by tools/pack_assets.py)
+// also carries the assets, so each one is a single seek into that file.
+// All integers are little-endian:
+//   header: magic, u16 version, u16 count, u32 strings_offset, u32 strings_bytes,
+//           u32 source_size, u32 source_mtime (the JSON's, 0 for a pack)
+//   entry:  u32 text, u32 wav, u32 bitmap (offsets into the strings blob),
+//           u16 sample_rate, u8 bpp, u8 pixel_flags,
+//           u32 pcm_offset, u32 pcm_bytes, u32 pixels_offset, u16 width, u16 height,
+//           f32 weight, u16 audio_format, u8 channels, u8 bits_per_sample,
+//           u16 block_align
+// The strings blob is the catalog arena as-is: NUL-terminated strings
+// starting with an empty one at offset 0. Asset offsets point at the WAV's
+// data chunk contents in the entry's format and BMP-style rows padded to 4
+// bytes; packed audio is 16-bit mono PCM or IMA-ADPCM as in its source file,
+// and packed pixels are always top-down RGB565.
+static constexpr const char* pack_path = "/responses.pak";
+static constexpr const char* index_path = "/responses.idx";
+static constexpr const uint32_t pack_magic = 0x5042384D;   // "M8BP"
+static constexpr const uint32_t index_magic = 0x4942384D;  // "M8BI"
+static constexpr const uint16_t catalog_version = 6;
+static constexpr const size_t catalog_header_bytes = 24;
+static constexpr const size_t catalog_entry_bytes = 42;
+static constexpr const uint8_t pixel_top_down = 0x01;
+static constexpr const uint8_t pixel_rgb555 = 0x02;
+
+// Pre-resolved location and format of a response's assets
+struct AssetEntry {
+    uint32_t pcm_offset = 0;
+    uint32_t pcm_bytes = 0;     // 0 when the response has no playable audio
+    uint16_t sample_rate = 0;
+    uint16_t audio_format = 0;  // WAV format tag, wave_format_pcm or wave_format_ima_adpcm
+    uint8_t channels = 0;
+    uint8_t bits_per_sample = 0;
+    uint16_t block_align = 0;
+    uint32_t pixels_offset = 0;
+    uint16_t width = 0;         // 0 when the response has no usable bitmap
+    uint16_t height = 0;
+    uint8_t bpp = 0;
+    uint8_t pixel_flags = 0;
+};
+
+static std::vector<AssetEntry> catalog_assets;  // Indexed like responses
+static bool assets_packed = false;              // Offsets are into responses.pak
+
+// Optional ambient loop, played from THINKING until the answer clip ends
+// and ducked under the clip. While it plays, audio goes out through the
+// mixer: each voice is scaled by its Q15 gain and added, saturating, into
+// mix_buffers one chunk at a time, so nothing is premixed ahead of the
+// speaker. Gain changes ramp across a chunk, which keeps fades click-free.
+static constexpr const char* ambient_path = "/audio/thinking.wav";
+static constexpr const int32_t mix_unity = 0x8000;                 // Q15 gain of 1.0
+static constexpr const int32_t answer_gain = mix_unity;
+static constexpr const int32_t ambient_gain = mix_unity / 2;
+static constexpr const int32_t ambient_duck_gain = mix_unity / 6;  // Under the answer clip
+static constexpr const int32_t mix_fade_step = mix_unity / 8;      // Per chunk, ~0.5s for a full fade
+
+struct AmbientVoice {
+    bool loaded = false;  // The loop was found and its buffers allocated
+    bool active = false;
+    File file;
+    AssetEntry asset;      // Where the loop's samples are and their format
+    WavConverter convert;  // Reads through its own buffer, not wav_raw
+    size_t remaining = 0;  // Output bytes left before it wraps
+    int32_t gain = 0;      // Q15, moved towards target by mix_fade_step a chunk
+    int32_t target = 0;
+    int16_t* samples = nullptr;  // One chunk of the loop
+};
+static AmbientVoice ambient;
+static int16_t* mix_buffers[play_buffer_count];
+static size_t mix_idx = 0;
 
 // State machine for Magic Eight Ball
 enum AppState { IDLE, TEXT_INPUT, VOICE_INPUT, THINKING, SHOWING_ANSWER };
 static AppState current_state = IDLE;
 static String current_question = "";
-static uint8_t current_response_idx = 0;
+static uint16_t current_response_idx = 0;
 static unsigned long state_timer = 0;
 static bool cursor_visible = true;
 static unsigned long last_cursor_blink = 0;
-static bool audio_played = false;
+static uint32_t thinking_seed = 0;   // The question's seed, until an answer is picked
+static bool answer_chosen = false;   // current_response_idx is set and prefetching
+
+// The card is mounted and the catalog loaded by catalog_task, behind an
+// idle screen that is already up. Typing and recording work straight away;
+// only picking an answer waits for CATALOG_READY, whose store publishes
+// responses, the alias table, catalog_assets, the asset cache and the
+// ambient loop to the other tasks.
+enum CatalogStatus : uint8_t { CATALOG_LOADING, CATALOG_READY, CATALOG_FAILED };
+static std::atomic<CatalogStatus> catalog_status{CATALOG_LOADING};
+static const char* catalog_error = "";  // Set before CATALOG_FAILED
+static constexpr const UBaseType_t catalog_task_priority = 1;  // Under audio_task, on its core
+static constexpr const uint32_t catalog_task_stack = 8192;
+static TaskHandle_t catalog_task = nullptr;  // Stale once it has finished, but no task is created after it
+static uint32_t boot_interactive_ms = 0;  // Idle screen shown and input running, from app start
+static uint32_t boot_catalog_ms = 0;      // Catalog ready or failed
+
+// Wrapped layout of the question being typed. Line starts are kept between
+// keystrokes so an edit only re-wraps and repaints from the line it touched.
+static constexpr const int question_x = 5;
+static constexpr const int question_y = 25;
+static constexpr const int question_line_height = 15;
+static std::vector<uint16_t> question_lines;  // Start offset of each wrapped line
+static int question_cursor_x = question_x;    // Where the cursor follows the text
+static int question_cursor_y = question_y;
+static bool question_dirty = false;  // Edited since the last text input repaint
+
+// Advance widths of the printable ASCII glyphs in the frame font, so wrapping
+// sums a table instead of calling textWidth() for every word
+struct GlyphAdvances {
+    const lgfx::IFont* font = nullptr;  // Font the table was built for
+    float text_size = 0;
+    uint8_t width[0x7F - 0x20];
+};
+static GlyphAdvances glyph_advances;
+
+// Wrapped lines of a text as byte runs. A run includes its inner spaces,
+// which print with the same advance the layout gave them.
+struct TextLine {
+    uint16_t start;
+    uint16_t length;
+};
+static constexpr const size_t text_layout_max_lines = 8;  // More than fit below the header
+struct TextLayout {
+    uint16_t idx = UINT16_MAX;  // Response this layout belongs to
+    int16_t max_width = 0;
+    uint8_t line_count = 0;
+    TextLine lines[text_layout_max_lines];
+};
+
+// Answer layouts, computed on first display and direct-mapped by response
+// index so showing an answer again is just its line draws
+static constexpr const size_t answer_layout_slots = 32;
+static TextLayout answer_layouts[answer_layout_slots];
+
+// UI pacing: input is polled on a fixed short interval while each state
+// renders at most at its own frame rate (0 = only redrawn on events), and
+// loop() sleeps until the next poll instead of spinning
+struct StatePacing {
+    uint16_t frame_ms;  // Minimum time between frames
+    uint16_t poll_ms;   // Input / audio service interval
+};
+static constexpr const StatePacing state_pacing[] = {
+    {0, 10},    // IDLE: static screen
+    {16, 5},    // TEXT_INPUT: keystroke repaints coalesced to ~60fps
+    {15, 5},    // VOICE_INPUT: waveform once per 15ms chunk
+    {100, 10},  // THINKING: dots only change every 500ms
+    {0, 10},    // SHOWING_ANSWER: static, audio_task feeds the speaker
+};
+static AppState paced_state = IDLE;
+static unsigned long next_frame_time = 0;
+static unsigned long next_poll_time = 0;
 
 // WAV文件头部定义
 struct WAVHeader {
@@ -73,24 +639,150 @@ struct WAVHeader {
 // Magic Eight Ball Functions
 bool generateDefaultConfig();  // Generate default responses.json if it doesn't exist
 bool loadResponsesFromSD();     // Load responses from SD card JSON file
+bool loadResponsesFromPack();   // Load responses and their assets' offsets from responses.pak
+bool loadResponsesFromIndex();  // Load the catalog compiled from an unchanged responses.json
+void resolveResponseAssets();   // Record each response's audio/bitmap offsets and formats
+bool resolveWavAsset(const char* path, AssetEntry& asset);  // Audio fields from a WAV header
+bool writeResponseIndex(uint32_t source_size, uint32_t source_mtime);
+
+// Catalog string arena
+bool reserveCatalogStrings(size_t capacity);
+void resetCatalogStrings();
+CatalogString appendCatalogString(const char* str, size_t length);
+CatalogString internCatalogPath(const char* path);  // Deduplicated, with a leading slash
+void finishCatalogStrings();                         // Trim the arena, drop the intern table
 
 // Randomness generation functions
 uint32_t generateSeedFromText(const String& question);
 uint32_t generateSeedFromAudio(int16_t* audio_data, size_t num_samples);
-uint8_t selectResponse(uint32_t seed);
+void accumulateAudioFeatures(AudioFeatures& features, const int16_t* audio_data, size_t num_samples);
+uint32_t generateSeedFromFeatures(const AudioFeatures& features);
+uint16_t selectResponse(uint32_t seed);
+void buildAliasTable();  // Precompute weighted selection after the catalog loads
 
 // Display functions
 void displayIdle();
 void displayTextInput(const String& question);
+void updateTextInput(const String& question);  // Repaint only lines changed by an edit
+void blinkTextInputCursor();                   // Repaint only the cursor cell
 void displayVoiceInput(int progress);
+void updateVoiceInput(int progress);  // Progress bar and waveform only
 void displayThinking();
-void displayAnswer(uint8_t idx);
-
-// Helper function for text wrapping
-void drawWrappedText(const String& text, int x, int y, int max_width, int line_height);
-
-// Audio playback function
-void playResponseAudio(const String& wav_path);
+void displayAnswer(uint16_t idx);
+void displayAnswer(uint16_t idx, AnswerBitmap& bitmap);
+void takeAnswerBitmap(uint16_t idx, AnswerBitmap& bitmap);  // While the UI owns the prefetch and cache
+void displayCatalogError();  // The card or catalog couldn't be loaded
+
+// Bitmap display (decoded into the frame, pushed by the caller)
+File openAssetFile(const char* path);  // Open an SD asset, tolerating a missing leading slash
+bool openBitmap(const char* bitmap_path, File& file, BmpInfo& info);
+bool drawBitmap(File& file, const BmpInfo& info, int x, int y, int32_t first_row = 0, uint16_t* cache_pixels = nullptr);
+void drawBitmapRows(const BmpInfo& info, uint8_t* rows_data, int32_t first_row, size_t rows, int x, int y,
+                    uint16_t* cache_pixels = nullptr);
+bool displayBitmap(const char* bitmap_path, int x, int y);
+bool openResponseBitmap(uint16_t idx, File& file, BmpInfo& info);  // From the pack or the BMP file
+bool openResponseAudio(uint16_t idx, File& file, size_t& bytes, WavConverter& convert);  // Positioned at the first sample
+void dropWavCopy(uint16_t idx, WavConverter& convert);  // Free a partly cached encoded clip
+bool readWavHeader(File& file, WAVHeader& header, uint32_t& data_offset);  // Walk the RIFF chunks to the data
+bool wavFormatSupported(uint16_t format, uint16_t channels, uint16_t bits, uint32_t rate, uint16_t block_align);
+size_t startWavConverter(WavConverter& convert, const AssetEntry& asset);  // Returns the output bytes
+size_t convertWavSamples(File& file, WavConverter& convert, int16_t* out, size_t samples);
+
+// Text layout
+void updateGlyphAdvances();  // Rebuild the advance table if the font changed
+int glyphTextWidth(const char* text, size_t length);
+void layoutText(const char* text, int x, int max_width, TextLayout& layout);
+void drawTextLayout(const char* text, const TextLayout& layout, int x, int y, int line_height);
+const TextLayout& answerLayout(uint16_t idx, int max_width);
+void drawWrappedText(const char* text, int x, int y, int max_width, int line_height);
+
+// Frame pushes. The panel has its own SPI host, so a DMA push runs while
+// the CPU (and audio_task's SD reads on the other host) carry on; anything
+// that draws into frame calls waitFramePush() first.
+void pushFrame();
+void pushFrameRegion(int x, int y, int w, int h);  // Without touching the rest of the panel
+void waitFramePush();                               // Block until frame is safe to draw into
+bool beginSD();                                     // Mount at the fastest clock that reads back clean
+
+// UI scheduler
+bool frameDue();          // True when the current state may render a frame
+void waitForNextPoll();   // Sleep until the next input poll
+
+// Voice capture helpers
+int16_t* voiceChunk(size_t chunk_idx);  // Ring slot holding a recorded chunk
+void queueVoiceChunks();
+void updateVoiceActivity(size_t chunk_idx, uint64_t chunk_sum_squares, uint16_t chunk_crossings);
+
+// Audio task: capture, playback and prefetch, driven by audio_commands
+void startAudioTask();
+void audioTask(void* arg);
+void handleAudioCommand(const AudioCommand& cmd);
+void serviceVoiceCapture();                        // Queue and analyse mic chunks, report progress
+void postAudioEvent(const AudioEvent& event, bool may_drop = false);
+void sendAudioCommand(AudioCommandType type, uint16_t idx = 0);
+void handleAudioEvents();                          // Drain audio_events into the UI state
+void waitForAudioEvent(AudioEventType type);       // Block loop() until the task answers
+
+// Input task and the state machine's handlers
+void startInputTask();
+void inputTask(void* arg);
+void postInputEvent(const InputEvent& event);
+void handleInputEvent(const InputEvent& event);  // Apply one event to the current state
+void noteKeyShown();                            // A repaint showing pending keys was pushed
+void printInputLatency();
+void startVoiceInput();
+void submitTextQuestion();
+void beginThinking(uint32_t seed);  // Enter THINKING, picking the answer once the catalog is ready
+void chooseAnswer();                // Select from thinking_seed and start the prefetch
+void returnToIdle();
+
+// Low-power IDLE
+void updateIdlePower();                         // Dim, then sleep, as IDLE stays untouched
+void noteInputActivity(const InputEvent& event);  // Restore the backlight, start timing a wake
+void finishWake();                              // Record the wake once its screen is pushed
+void sleepUntilNextScan();                      // input_task's light-sleeping scan interval
+
+// Boot
+void startCatalogTask();
+void catalogTask(void* arg);
+bool loadCatalog();           // Mount the card and load everything answers need
+void printCardDiagnostics();
+
+// Audio playback functions
+void useAudioDevice(AudioDevice device);  // Hand I2S to the mic or speaker, no-op if it has it
+bool playResponseAudio(uint16_t idx);             // Start a response's clip, from cache or SD
+bool startResponseAudio(const char* wav_path);    // Begin playback of an opened clip
+bool updateResponseAudio();                      // Keep the speaker fed, false once finished
+void stopResponseAudio();                        // Cancel playback immediately
+
+// Mixer and ambient loop
+bool loadAmbientLoop();                 // Find ambient_path and allocate its buffers
+void startAmbient();                    // Fade the loop in from wherever it is
+void setAmbientTarget(int32_t gain);    // Fade towards gain, stopping at 0
+void stopAmbient();                     // Drop the loop without a fade
+void updateMixer();                     // Queue mixed chunks while the speaker has room
+
+// Asset prefetch during THINKING
+void startPrefetch(uint16_t idx);  // Begin pre-reading a response's WAV and bitmap
+bool stepPrefetch();              // Do one SD read, false once everything is ready
+void finishPrefetch();            // Complete any remaining steps now
+void cancelPrefetch();            // Close anything the answer screen didn't take
+
+// Asset cache
+void initAssetCache();                             // Size the cache for the loaded responses
+CachedAsset* findCachedAsset(uint16_t idx);         // Slot for a response, marked as recently used
+void* allocCachedBytes(uint16_t idx, size_t bytes);  // Evict LRU slots until the budget fits
+void freeCachedPcm(CachedAsset& entry);
+void freeCachedPixels(CachedAsset& entry);
+void printAssetCacheStats();
+
+// Profiling
+void recordProfile(ProfilePoint point, uint32_t cycles, size_t bytes = 0);
+ProfileStat profileTotals(ProfilePoint point);  // Every task's row added up
+size_t readSD(File& file, void* buffer, size_t bytes);  // file.read() timed as PROF_SD_READ
+void toggleProfileOverlay();
+void refreshProfileOverlay();  // Reformat the figures and push the band
+void dumpProfile();            // One line per stat on Serial
 
 // Generate default responses.json file on SD card
 bool generateDefaultConfig() {
@@ -210,6 +902,17 @@ bool generateDefaultConfig() {
     return true;
 }
 
+// Skip whitespace between array elements and return the next character
+// without consuming it (-1 at end of file)
+static int skipJsonWhitespace(Stream& stream) {
+    int c = stream.peek();
+    while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        stream.read();
+        c = stream.peek();
+    }
+    return c;
+}
+
 // Load responses from SD card JSON file
 bool loadResponsesFromSD() {
     File file = SD.open("/responses.json", FILE_READ);
@@ -218,366 +921,2703 @@ bool loadResponsesFromSD() {
         return false;
     }
 
-    // Parse JSON file
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, file);
-    file.close();
-
-    if (error) {
-        printf("Failed to parse responses.json: %s\n", error.c_str());
-        return false;
-    }
-
-    // Check if root is an array
-    if (!doc.is<JsonArray>()) {
+    // Parse the array one element at a time, so only a single response
+    // (and only the fields we use) is ever held as a DOM
+    uint32_t json_size = file.size();
+    uint32_t json_mtime = file.getLastWrite();
+    if (!file.find("[")) {
         printf("responses.json must contain an array\n");
+        file.close();
         return false;
     }
 
-    JsonArray array = doc.as<JsonArray>();
-    responses.clear();
+    JsonDocument filter;
+    filter["text"] = true;
+    filter["wav"] = true;
+    filter["bitmap"] = true;
+    filter["weight"] = true;
 
-    // Load each response
-    for (JsonObject obj : array) {
-        Response r;
-        r.text = obj["text"] | "";
-        r.wav_path = obj["wav"] | "";
-        r.bitmap_path = obj["bitmap"] | "";
+    JsonDocument doc;
+    responses.clear();
+    resetCatalogStrings();
+    while (skipJsonWhitespace(file) != ']') {
+        DeserializationError error = deserializeJson(doc, file, DeserializationOption::Filter(filter));
+        if (error) {
+            printf("Failed to parse responses.json entry %d: %s\n", responses.size(), error.c_str());
+            file.close();
+            return false;
+        }
 
-        if (r.text.isEmpty()) {
+        const char* text = doc["text"] | "";
+        if (text[0] == '\0') {
             printf("Skipping response with empty text\n");
-            continue;
+        } else {
+            Response r;
+            r.text = appendCatalogString(text, strlen(text));
+            r.wav_path = internCatalogPath(doc["wav"] | "");
+            r.bitmap_path = internCatalogPath(doc["bitmap"] | "");
+            r.weight = doc["weight"] | 1.0f;
+            if (!std::isfinite(r.weight) || r.weight < 0.0f) r.weight = 0.0f;
+            responses.push_back(r);
+        }
+        if (responses.size() >= max_responses) {
+            printf("Ignoring responses past the first %d\n", max_responses);
+            break;
         }
 
-        responses.push_back(r);
+        // Step over the separator; stop at the closing bracket
+        if (!file.findUntil(",", "]")) break;
     }
+    file.close();
+    finishCatalogStrings();
 
     printf("Loaded %d responses from SD card\n", responses.size());
-    return responses.size() > 0;
+    if (responses.empty()) return false;
+
+    // Compile the index so later boots can skip parsing and asset lookups
+    resolveResponseAssets();
+    writeResponseIndex(json_size, json_mtime);
+    return true;
 }
 
-// Generate random seed from text input using DJB2 hash + timestamp
-uint32_t generateSeedFromText(const String& question) {
-    uint32_t hash = 5381;
-    for (size_t i = 0; i < question.length(); i++) {
-        hash = ((hash << 5) + hash) + tolower(question[i]);
+static uint16_t readLE16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static uint32_t readLE32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static void writeLE16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void writeLE32(uint8_t* p, uint32_t v) { writeLE16(p, v); writeLE16(p + 2, v >> 16); }
+
+// Read a compiled catalog (index or pack) into responses and catalog_assets.
+// Fails if the file is missing, malformed, or was built from a different
+// source_size/source_mtime.
+static bool loadCatalogFile(const char* path, uint32_t magic, uint32_t source_size, uint32_t source_mtime) {
+    File file = SD.open(path, FILE_READ);
+    if (!file) {
+        return false;
     }
-    hash ^= millis(); // Mix in timestamp
-    // Additional mixing for better distribution
-    hash ^= (hash >> 16);
-    hash *= 0x85ebca6b;
-    hash ^= (hash >> 13);
-    return hash;
-}
 
-// Generate random seed from audio waveform analysis
-uint32_t generateSeedFromAudio(int16_t* audio_data, size_t num_samples) {
-    uint32_t seed = 0;
+    uint8_t header[catalog_header_bytes];
+    if (file.read(header, sizeof(header)) != sizeof(header) ||
+        readLE32(header) != magic || readLE16(header + 4) != catalog_version) {
+        printf("Ignoring %s: bad header\n", path);
+        file.close();
+        return false;
+    }
+    if (readLE32(header + 16) != source_size || readLE32(header + 20) != source_mtime) {
+        printf("Ignoring %s: responses.json has changed\n", path);
+        file.close();
+        return false;
+    }
 
-    // Peak amplitude
-    int16_t peak = 0;
-    for (size_t i = 0; i < num_samples; i++) {
-        int16_t abs_val = abs(audio_data[i]);
-        if (abs_val > peak) peak = abs_val;
+    uint16_t count = readLE16(header + 6);
+    uint32_t strings_offset = readLE32(header + 8);
+    uint32_t strings_bytes = readLE32(header + 12);
+    if (count == 0) {
+        printf("Ignoring %s: no responses\n", path);
+        file.close();
+        return false;
+    }
+    // Check the table and blob fit in the file before sizing anything by them
+    uint64_t table_end = catalog_header_bytes + (uint64_t)count * catalog_entry_bytes;
+    if (strings_bytes == 0 || table_end > file.size() || (uint64_t)strings_offset + strings_bytes > file.size()) {
+        printf("Ignoring %s: sizes don't match the file\n", path);
+        file.close();
+        return false;
     }
-    seed ^= (uint32_t)peak;
 
-    // Zero-crossing count
-    uint16_t zero_crossings = 0;
-    for (size_t i = 1; i < num_samples; i++) {
-        if ((audio_data[i-1] < 0 && audio_data[i] >= 0) ||
-            (audio_data[i-1] >= 0 && audio_data[i] < 0)) {
-            zero_crossings++;
-        }
+    // Entry table follows the header; the strings blob is read straight
+    // into the arena, with a NUL after it so no string can overrun
+    std::vector<uint8_t> table(count * catalog_entry_bytes);
+    bool ok = file.read(table.data(), table.size()) == table.size();
+    ok = ok && reserveCatalogStrings(strings_bytes + 1);
+    ok = ok && file.seek(strings_offset) &&
+         file.read((uint8_t*)catalog_strings.data, strings_bytes) == strings_bytes;
+    file.close();
+    if (!ok) {
+        printf("Failed to read %s\n", path);
+        return false;
     }
-    seed ^= ((uint32_t)zero_crossings << 8);
+    catalog_strings.data[strings_bytes] = '\0';
+    catalog_strings.size = strings_bytes + 1;
 
-    // RMS energy
-    uint64_t sum_squares = 0;
-    for (size_t i = 0; i < num_samples; i++) {
-        sum_squares += (int32_t)audio_data[i] * audio_data[i];
+    responses.clear();
+    catalog_assets.clear();
+    for (uint16_t i = 0; i < count; i++) {
+        const uint8_t* e = table.data() + i * catalog_entry_bytes;
+        Response r;
+        uint32_t offsets[3] = {readLE32(e), readLE32(e + 4), readLE32(e + 8)};
+        CatalogString* fields[3] = {&r.text, &r.wav_path, &r.bitmap_path};
+        bool valid = true;
+        for (int f = 0; f < 3; f++) {
+            valid = valid && offsets[f] < strings_bytes;
+            if (valid) {
+                fields[f]->offset = offsets[f];
+                fields[f]->length = strlen(catalog_strings.data + offsets[f]);
+            }
+        }
+        if (!valid) {
+            printf("Skipping %s entry %d with bad strings\n", path, i);
+            continue;
+        }
+        if (r.text.isEmpty()) {
+            printf("Skipping response with empty text\n");
+            continue;
+        }
+
+        AssetEntry asset;
+        asset.sample_rate = readLE16(e + 12);
+        asset.bpp = e[14];
+        asset.pixel_flags = e[15];
+        asset.pcm_offset = readLE32(e + 16);
+        asset.pcm_bytes = readLE32(e + 20);
+        asset.pixels_offset = readLE32(e + 24);
+        asset.width = readLE16(e + 28);
+        asset.height = readLE16(e + 30);
+        uint32_t weight_bits = readLE32(e + 32);
+        memcpy(&r.weight, &weight_bits, sizeof(r.weight));
+        if (!std::isfinite(r.weight) || r.weight < 0.0f) r.weight = 0.0f;
+        asset.audio_format = readLE16(e + 36);
+        asset.channels = e[38];
+        asset.bits_per_sample = e[39];
+        asset.block_align = readLE16(e + 40);
+        if (asset.pcm_bytes > 0 && !wavFormatSupported(asset.audio_format, asset.channels, asset.bits_per_sample,
+                                                       asset.sample_rate, asset.block_align)) {
+            printf("Response %d audio format is not supported\n", i);
+            asset.pcm_bytes = 0;
+        }
+        if ((asset.width > 0 || asset.height > 0) && asset.bpp != 16 && asset.bpp != 24) {
+            printf("Response %d bitmap format is not supported\n", i);
+            asset.width = asset.height = 0;
+        }
+
+        responses.push_back(r);
+        catalog_assets.push_back(asset);
     }
-    uint32_t rms = sqrt(sum_squares / num_samples);
-    seed ^= (rms << 16);
 
-    seed ^= millis(); // Mix in timestamp
-    return seed;
+    printf("Loaded %d responses from %s\n", responses.size(), path);
+    return responses.size() > 0;
 }
 
-// Select response index based on seed
-uint8_t selectResponse(uint32_t seed) {
-    if (responses.size() == 0) return 0;
-    return seed % responses.size();
+// Load responses and assets from the packed bundle
+bool loadResponsesFromPack() {
+    assets_packed = loadCatalogFile(pack_path, pack_magic, 0, 0);
+    return assets_packed;
 }
 
-// Helper function to draw wrapped text
-void drawWrappedText(const String& text, int x, int y, int max_width, int line_height) {
-    int cursor_x = x;
-    int cursor_y = y;
-    String current_word = "";
-
-    for (size_t i = 0; i < text.length(); i++) {
-        char c = text[i];
-
-        if (c == ' ' || c == '\n' || i == text.length() - 1) {
-            // Add last character if end of string
-            if (i == text.length() - 1 && c != ' ' && c != '\n') {
-                current_word += c;
-            }
+// Load the index compiled from responses.json, if it is still current
+bool loadResponsesFromIndex() {
+    File json = SD.open("/responses.json", FILE_READ);
+    if (!json) {
+        return false;
+    }
+    uint32_t size = json.size();
+    uint32_t mtime = json.getLastWrite();
+    json.close();
+    return loadCatalogFile(index_path, index_magic, size, mtime);
+}
 
-            // Check if word fits on current line
-            int word_width = M5Cardputer.Display.textWidth(current_word);
+// Fill asset's audio fields from a WAV file's header, reporting why it
+// can't be played if it can't
+bool resolveWavAsset(const char* path, AssetEntry& asset) {
+    File file = openAssetFile(path);
+    WAVHeader header;
+    uint32_t data_offset = 0;
+    bool ok = false;
+    if (!file) {
+        printf("Audio file not found: %s\n", path);
+    } else if (!readWavHeader(file, header, data_offset)) {
+        printf("Invalid WAV file: %s\n", path);
+    } else if (!wavFormatSupported(header.audioFormat, header.numChannels, header.bitsPerSample,
+                                   header.sampleRate, header.blockAlign)) {
+        printf("Unsupported WAV format %d (%d ch, %d-bit, %dHz): %s\n", header.audioFormat,
+               header.numChannels, header.bitsPerSample, header.sampleRate, path);
+    } else {
+        // ADPCM is consumed block by block, PCM frame by frame
+        size_t unit = header.audioFormat == wave_format_ima_adpcm
+                          ? 1 : header.numChannels * header.bitsPerSample / 8;
+        asset.pcm_offset = data_offset;
+        asset.pcm_bytes = header.dataSize - header.dataSize % unit;
+        asset.sample_rate = header.sampleRate;
+        asset.audio_format = header.audioFormat;
+        asset.channels = header.numChannels;  // Both checked above, so they fit in a byte
+        asset.bits_per_sample = header.bitsPerSample;
+        asset.block_align = header.blockAlign;
+        ok = true;
+    }
+    if (file) file.close();
+    return ok;
+}
 
-            if (cursor_x + word_width > max_width && cursor_x > x) {
-                // Move to next line
-                cursor_x = x;
-                cursor_y += line_height;
-            }
+// Open every response's WAV and BMP once to record where its samples and
+// pixels start
+void resolveResponseAssets() {
+    catalog_assets.assign(responses.size(), AssetEntry());
+    for (size_t i = 0; i < responses.size(); i++) {
+        const Response& r = responses[i];
+        AssetEntry& asset = catalog_assets[i];
 
-            // Draw the word
-            M5Cardputer.Display.setCursor(cursor_x, cursor_y);
-            M5Cardputer.Display.print(current_word);
-            cursor_x += word_width;
+        if (!r.wav_path.isEmpty()) {
+            resolveWavAsset(r.wav_path.c_str(), asset);
+        }
 
-            // Add space after word
-            if (c == ' ') {
-                cursor_x += M5Cardputer.Display.textWidth(" ");
-            } else if (c == '\n') {
-                cursor_x = x;
-                cursor_y += line_height;
+        if (!r.bitmap_path.isEmpty()) {
+            File file;
+            BmpInfo info;
+            if (openBitmap(r.bitmap_path.c_str(), file, info)) {
+                asset.pixels_offset = info.data_offset;
+                asset.width = info.width;
+                asset.height = info.height;
+                asset.bpp = info.bpp;
+                asset.pixel_flags = (info.top_down ? pixel_top_down : 0) | (info.rgb555 ? pixel_rgb555 : 0);
+                file.close();
             }
-
-            current_word = "";
-        } else {
-            current_word += c;
         }
     }
 }
 
-// Display idle screen with prompt
-void displayIdle() {
-    M5Cardputer.Display.clear();
-    M5Cardputer.Display.setTextDatum(top_left);
-    M5Cardputer.Display.setTextSize(1);
+// Write responses and catalog_assets as responses.idx, tagged with the
+// JSON's size and mtime. The arena is written as the strings blob unchanged,
+// so interned paths stay shared.
+bool writeResponseIndex(uint32_t source_size, uint32_t source_mtime) {
+    uint32_t strings_offset = catalog_header_bytes + responses.size() * catalog_entry_bytes;
 
-    M5Cardputer.Display.setTextColor(WHITE);
-    M5Cardputer.Display.drawString("MAGIC EIGHT BALL", 5, 5);
+    File file = SD.open(index_path, FILE_WRITE);
+    if (!file) {
+        printf("Failed to create %s\n", index_path);
+        return false;
+    }
 
-    M5Cardputer.Display.setTextColor(CYAN);
-    M5Cardputer.Display.drawString("Type your question", 5, 30);
-    M5Cardputer.Display.drawString("Press Enter or [Go]", 5, 45);
+    uint8_t header[catalog_header_bytes];
+    writeLE32(header, index_magic);
+    writeLE16(header + 4, catalog_version);
+    writeLE16(header + 6, responses.size());
+    writeLE32(header + 8, strings_offset);
+    writeLE32(header + 12, catalog_strings.size);
+    writeLE32(header + 16, source_size);
+    writeLE32(header + 20, source_mtime);
+    file.write(header, sizeof(header));
+
+    for (size_t i = 0; i < responses.size(); i++) {
+        const Response& r = responses[i];
+        const AssetEntry& asset = catalog_assets[i];
+        uint8_t e[catalog_entry_bytes];
+        writeLE32(e, r.text.offset);
+        writeLE32(e + 4, r.wav_path.offset);
+        writeLE32(e + 8, r.bitmap_path.offset);
+        writeLE16(e + 12, asset.sample_rate);
+        e[14] = asset.bpp;
+        e[15] = asset.pixel_flags;
+        writeLE32(e + 16, asset.pcm_offset);
+        writeLE32(e + 20, asset.pcm_bytes);
+        writeLE32(e + 24, asset.pixels_offset);
+        writeLE16(e + 28, asset.width);
+        writeLE16(e + 30, asset.height);
+        uint32_t weight_bits;
+        memcpy(&weight_bits, &r.weight, sizeof(weight_bits));
+        writeLE32(e + 32, weight_bits);
+        writeLE16(e + 36, asset.audio_format);
+        e[38] = asset.channels;
+        e[39] = asset.bits_per_sample;
+        writeLE16(e + 40, asset.block_align);
+        file.write(e, sizeof(e));
+    }
+    file.write((const uint8_t*)catalog_strings.data, catalog_strings.size);
 
-    M5Cardputer.Display.setTextColor(YELLOW);
-    M5Cardputer.Display.drawString("Press [Go] for voice", 5, 70);
+    bool ok = file.size() == strings_offset + catalog_strings.size;
+    file.close();
+    printf("Wrote %s (%d responses, %d string bytes)\n", index_path, responses.size(), catalog_strings.size);
+    return ok;
 }
 
-// Display text input with blinking cursor
-void displayTextInput(const String& question) {
-    M5Cardputer.Display.clear();
-    M5Cardputer.Display.setTextDatum(top_left);
-    M5Cardputer.Display.setTextSize(1);
+// Grow (or shrink) the arena to capacity bytes, keeping its contents
+bool reserveCatalogStrings(size_t capacity) {
+    uint32_t caps = psramFound() ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    char* data = (char*)heap_caps_realloc(catalog_strings.data, capacity, caps);
+    if (!data) {
+        printf("Failed to allocate %d bytes of catalog strings\n", capacity);
+        return false;
+    }
+    catalog_strings.data = data;
+    catalog_strings.capacity = capacity;
+    catalog_strings.size = std::min(catalog_strings.size, capacity);
+    return true;
+}
 
-    M5Cardputer.Display.setTextColor(WHITE);
-    M5Cardputer.Display.drawString("Your Question:", 5, 5);
+// Start an empty catalog: just the shared empty string at offset 0
+void resetCatalogStrings() {
+    catalog_strings.size = 0;
+    if (catalog_strings.capacity < 1024 && !reserveCatalogStrings(1024)) return;
+    catalog_strings.data[0] = '\0';
+    catalog_strings.size = 1;
+    intern_slots.assign(64, 0);
+    intern_count = 0;
+}
 
-    M5Cardputer.Display.setTextColor(CYAN);
-    String display_text = question;
-    if (cursor_visible) {
-        display_text += "_";
+// Copy a string into the arena, doubling it as needed
+CatalogString appendCatalogString(const char* str, size_t length) {
+    CatalogString result;
+    if (length == 0) return result;
+
+    length = std::min<size_t>(length, UINT16_MAX);
+    if (catalog_strings.size + length + 1 > catalog_strings.capacity &&
+        !reserveCatalogStrings(std::max(catalog_strings.capacity * 2, catalog_strings.size + length + 1))) {
+        return result;
     }
-    drawWrappedText(display_text, 5, 25, M5Cardputer.Display.width() - 10, 15);
+    result.offset = catalog_strings.size;
+    result.length = length;
+    memcpy(catalog_strings.data + result.offset, str, length);
+    catalog_strings.data[result.offset + length] = '\0';
+    catalog_strings.size += length + 1;
+    return result;
+}
 
-    M5Cardputer.Display.setTextColor(YELLOW);
-    M5Cardputer.Display.drawString("Enter or [Go] to submit", 5, 110);
+static uint32_t hashCatalogString(const char* str) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    while (*str) {
+        hash = (hash ^ (uint8_t)*str++) * 16777619u;
+    }
+    return hash;
 }
 
-// Display voice recording progress with waveform
-void displayVoiceInput(int progress) {
-    M5Cardputer.Display.clear();
-    M5Cardputer.Display.setTextDatum(top_left);
-    M5Cardputer.Display.setTextSize(1);
+// Append a path with the leading slash SD.open() expects, then fold it into
+// an earlier identical path if there is one
+CatalogString internCatalogPath(const char* path) {
+    if (path[0] == '\0') return CatalogString();
+
+    size_t mark = catalog_strings.size;
+    CatalogString result = path[0] == '/' ? appendCatalogString(path, strlen(path))
+                                          : appendCatalogString("/", 1);
+    if (path[0] != '/' && result.length) {
+        // Extend the "/" just appended in place
+        catalog_strings.size--;
+        CatalogString rest = appendCatalogString(path, strlen(path));
+        result.length = rest.length ? rest.length + 1 : 0;
+    }
+    if (result.length == 0) return CatalogString();
+
+    // Keep the table at most half full
+    if ((intern_count + 1) * 2 > intern_slots.size()) {
+        std::vector<uint32_t> old_slots;
+        old_slots.swap(intern_slots);
+        intern_slots.assign(std::max<size_t>(64, old_slots.size() * 2), 0);
+        for (uint32_t offset : old_slots) {
+            if (offset == 0) continue;
+            size_t slot = hashCatalogString(catalog_strings.data + offset) & (intern_slots.size() - 1);
+            while (intern_slots[slot]) slot = (slot + 1) & (intern_slots.size() - 1);
+            intern_slots[slot] = offset;
+        }
+    }
 
-    M5Cardputer.Display.setTextColor(WHITE);
-    M5Cardputer.Display.drawString("Recording...", 5, 5);
+    size_t slot = hashCatalogString(result.c_str()) & (intern_slots.size() - 1);
+    while (intern_slots[slot]) {
+        if (strcmp(catalog_strings.data + intern_slots[slot], result.c_str()) == 0) {
+            catalog_strings.size = mark;  // Drop the duplicate just appended
+            result.offset = intern_slots[slot];
+            return result;
+        }
+        slot = (slot + 1) & (intern_slots.size() - 1);
+    }
+    intern_slots[slot] = result.offset;
+    intern_count++;
+    return result;
+}
 
-    // Progress bar
-    int bar_width = (M5Cardputer.Display.width() - 20) * progress / 100;
-    M5Cardputer.Display.fillRect(5, 30, bar_width, 10, GREEN);
-    M5Cardputer.Display.drawRect(5, 30, M5Cardputer.Display.width() - 10, 10, WHITE);
+// Loading is done: give back the arena's slack and the intern table
+void finishCatalogStrings() {
+    reserveCatalogStrings(catalog_strings.size);
+    std::vector<uint32_t>().swap(intern_slots);
+    intern_count = 0;
+}
 
-    // Draw waveform from current buffer
-    int y_center = M5Cardputer.Display.height() / 2 + 10;
-    for (int x = 0; x < record_length && x < M5Cardputer.Display.width(); x++) {
-        size_t idx = draw_record_idx * record_length + x;
-        if (idx < record_size) {
-            int16_t sample = rec_data[idx];
-            int y = y_center + (sample / 2048); // Scale down for display
-            M5Cardputer.Display.drawPixel(x, y, CYAN);
+// Open a response's clip positioned at its first sample, from the pack or
+// the WAV file, and set up its conversion. bytes is what will be played.
+// A loose file smaller than the index expects is stale.
+bool openResponseAudio(uint16_t idx, File& file, size_t& bytes, WavConverter& convert) {
+    if (idx >= catalog_assets.size() || catalog_assets[idx].pcm_bytes == 0) return false;
+
+    const AssetEntry& asset = catalog_assets[idx];
+    file = openAssetFile(assets_packed ? pack_path : responses[idx].wav_path.c_str());
+    if (!file) return false;
+    if (file.size() < asset.pcm_offset + asset.pcm_bytes) {
+        printf("Stale index entry for %s\n", responses[idx].wav_path.c_str());
+        file.close();
+        return false;
+    }
+    file.seek(asset.pcm_offset);
+    bytes = startWavConverter(convert, asset);
+
+    // Encoded clips are cached as read, so a replay decodes from RAM
+    CachedAsset* cached = asset.audio_format == wave_format_ima_adpcm ? findCachedAsset(idx) : nullptr;
+    if (cached && !cached->pcm) {
+        cached->pcm = (int16_t*)allocCachedBytes(idx, asset.pcm_bytes);
+        if (cached->pcm) {
+            cached->pcm_bytes = asset.pcm_bytes;
+            convert.copy_to = (uint8_t*)cached->pcm;
         }
     }
+    return true;
 }
 
-// Display thinking animation
-void displayThinking() {
-    M5Cardputer.Display.clear();
-    M5Cardputer.Display.setTextDatum(top_left);
-    M5Cardputer.Display.setTextSize(1);
-    M5Cardputer.Display.setTextColor(MAGENTA);
+// Give up on an encoded clip's partial copy into the cache
+void dropWavCopy(uint16_t idx, WavConverter& convert) {
+    if (!convert.copy_to) return;
+    freeCachedPcm(asset_cache.entries[idx]);
+    convert.copy_to = nullptr;
+}
 
-    // Animate dots based on time
-    String dots = "";
-    int dot_count = (millis() / 500) % 4;
-    for (int i = 0; i < dot_count; i++) {
-        dots += ".";
+// Walk a WAV file's RIFF chunks, filling the fmt fields and data size of
+// header and leaving the file at the first sample. LIST, fact and any other
+// chunks are skipped, so the samples needn't start at byte 44.
+bool readWavHeader(File& file, WAVHeader& header, uint32_t& data_offset) {
+    if (file.read((uint8_t*)header.riff, 12) != 12 ||
+        memcmp(header.riff, "RIFF", 4) != 0 || memcmp(header.wave, "WAVE", 4) != 0) {
+        return false;
     }
 
-    M5Cardputer.Display.drawString("Thinking" + dots, 5, M5Cardputer.Display.height() / 2 - 10);
+    bool have_fmt = false;
+    uint32_t pos = 12;
+    uint32_t file_size = file.size();
+    while (file_size - pos >= 8) {
+        uint8_t chunk[8];
+        file.seek(pos);
+        if (file.read(chunk, sizeof(chunk)) != sizeof(chunk)) return false;
+        uint32_t size = readLE32(chunk + 4);
+        pos += sizeof(chunk);
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            // audioFormat through bitsPerSample, any extension is ignored
+            if (size < 16 || file.read((uint8_t*)&header.audioFormat, 16) != 16) return false;
+            header.fmtSize = size;
+            have_fmt = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt) return false;
+            // Streamed recordings can leave the size unset
+            header.dataSize = std::min(size, file_size - pos);
+            data_offset = pos;
+            return true;
+        }
+        if (size > file_size - pos) break;
+        pos += size + (size & 1);
+    }
+    return false;
 }
 
-// Display answer with audio/bitmap indicators
-void displayAnswer(uint8_t idx) {
-    if (idx >= responses.size()) return;
+// Formats the streaming converter can play
+bool wavFormatSupported(uint16_t format, uint16_t channels, uint16_t bits, uint32_t rate, uint16_t block_align) {
+    if ((channels != 1 && channels != 2) || rate == 0 || rate > UINT16_MAX) return false;
+    if (format == wave_format_ima_adpcm) {
+        return bits == 4 && block_align > 4 * channels && block_align <= wav_raw_bytes;
+    }
+    return format == wave_format_pcm && (bits == 8 || bits == 16);
+}
 
-    M5Cardputer.Display.clear();
-    M5Cardputer.Display.setTextDatum(top_left);
-    M5Cardputer.Display.setTextSize(1);
+// Frames in an IMA-ADPCM block of the given size: the header sample, then
+// 8 per 4 bytes of each channel's interleaved nibbles
+static size_t imaBlockFrames(size_t bytes, uint8_t channels) {
+    size_t header = 4 * channels;
+    return bytes < header ? 0 : 1 + (bytes - header) / header * 8;
+}
 
-    M5Cardputer.Display.setTextColor(GREEN);
-    String header = "Answer:";
-    if (!responses[idx].wav_path.isEmpty()) {
-        header += " [AUDIO]";
+// Prepare to convert asset's samples. Returns how many output bytes the clip
+// makes, which is exact, so playback can count down to the end as it does
+// for clips read straight from the file.
+size_t startWavConverter(WavConverter& convert, const AssetEntry& asset) {
+    size_t frames;
+    convert.format = asset.audio_format;
+    convert.channels = asset.channels;
+    convert.bits = asset.bits_per_sample;
+    convert.block_align = asset.block_align;
+    convert.memory = nullptr;
+    convert.copy_to = nullptr;
+    convert.copied = 0;
+    if (asset.audio_format == wave_format_ima_adpcm) {
+        frames = asset.pcm_bytes / asset.block_align * imaBlockFrames(asset.block_align, asset.channels) +
+                 imaBlockFrames(asset.pcm_bytes % asset.block_align, asset.channels);
+        convert.active = true;
+        convert.file_remaining = asset.pcm_bytes;
+        convert.block_frames = convert.block_frame = 0;
+    } else {
+        size_t frame_bytes = asset.channels * asset.bits_per_sample / 8;
+        frames = asset.pcm_bytes / frame_bytes;
+        convert.active = !(asset.channels == 1 && asset.bits_per_sample == 16 && asset.sample_rate == record_samplerate);
+        convert.file_remaining = frames * frame_bytes;
+    }
+    if (!convert.active) {
+        return frames * sizeof(int16_t);
     }
-    M5Cardputer.Display.drawString(header, 5, 5);
 
-    M5Cardputer.Display.setTextColor(WHITE);
-    drawWrappedText(responses[idx].text, 5, 25, M5Cardputer.Display.width() - 10, 15);
+    convert.step = ((uint64_t)asset.sample_rate << 16) / record_samplerate;
+    convert.phase = 2 << 16;  // The first two frames load a and b
+    convert.a = convert.b = 0;
+    convert.raw_pos = convert.raw_len = 0;
 
-    M5Cardputer.Display.setTextColor(YELLOW);
-    M5Cardputer.Display.drawString("Press [Go] to continue", 5, 110);
+    // One sample per step while a frame is left after a
+    size_t samples = frames > 1 ? ((uint64_t)(frames - 1) * 0x10000 + convert.step - 1) / convert.step : 0;
+    return samples * sizeof(int16_t);
 }
 
-// Play response audio from SD card
-void playResponseAudio(const String& wav_path) {
-    if (wav_path.isEmpty()) {
-        printf("No audio file specified\n");
-        return;
+// Point raw at the next bytes of the clip, from the cached copy or read
+// from the file into buffer (and copied to the cache if one is being filled)
+static bool refillWavRaw(File& file, WavConverter& convert, size_t bytes) {
+    bytes = std::min(convert.file_remaining, bytes);
+    if (bytes == 0) return false;
+    if (convert.memory) {
+        convert.raw = convert.memory + convert.copied;
+        convert.copied += bytes;
+    } else {
+        if (readSD(file, convert.buffer, bytes) != bytes) return false;
+        convert.raw = convert.buffer;
+        if (convert.copy_to) {
+            memcpy(convert.copy_to + convert.copied, convert.buffer, bytes);
+            convert.copied += bytes;
+        }
     }
+    convert.file_remaining -= bytes;
+    convert.raw_pos = 0;
+    convert.raw_len = bytes;
+    return true;
+}
 
-    // Try path as-is first
-    File file = SD.open(wav_path.c_str());
-
-    // If that fails, try with leading slash
-    if (!file && !wav_path.startsWith("/")) {
-        String alt_path = "/" + wav_path;
-        file = SD.open(alt_path.c_str());
+// One PCM frame as a mono 16-bit sample
+static inline int32_t wavFrameSample(const uint8_t* p, uint8_t channels, uint8_t bits) {
+    if (bits == 8) {
+        int32_t sample = (p[0] - 128) * 256;
+        return channels == 2 ? (sample + (p[1] - 128) * 256) >> 1 : sample;
     }
+    int32_t sample = (int16_t)(p[0] | p[1] << 8);
+    return channels == 2 ? (sample + (int16_t)(p[2] | p[3] << 8)) >> 1 : sample;
+}
 
-    if (!file) {
-        printf("Audio file not found: %s\n", wav_path.c_str());
+static constexpr const int16_t ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+    337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+    2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+static constexpr const int8_t ima_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+// Decode one IMA-ADPCM nibble for channel ch
+static inline int32_t imaDecodeNibble(WavConverter& convert, int ch, uint8_t nibble) {
+    int32_t step = ima_step_table[convert.step_index[ch]];
+    int32_t diff = step >> 3;
+    if (nibble & 1) diff += step >> 2;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 4) diff += step;
+    if (nibble & 8) diff = -diff;
+    convert.predictor[ch] = std::max<int32_t>(-32768, std::min<int32_t>(32767, convert.predictor[ch] + diff));
+    convert.step_index[ch] = std::max(0, std::min(88, convert.step_index[ch] + ima_index_table[nibble]));
+    return convert.predictor[ch];
+}
 
-        // Show error on screen
-        M5Cardputer.Display.setTextColor(RED);
-        M5Cardputer.Display.drawString("Audio file not found!", 5, 90);
-        M5Cardputer.Display.drawString(wav_path, 5, 105);
-        delay(2000);
-        return;
+// Next frame of the ADPCM block in raw as a mono sample. Frame 0 is the
+// header's predictor; after that each channel's nibbles come in 4-byte runs
+// of 8 samples, interleaved channel by channel.
+static inline int32_t imaFrameSample(WavConverter& convert) {
+    const uint8_t* block = convert.raw;
+    size_t frame = convert.block_frame++;
+    int32_t sum = 0;
+    for (int ch = 0; ch < convert.channels; ch++) {
+        if (frame == 0) {
+            convert.predictor[ch] = (int16_t)(block[4 * ch] | block[4 * ch + 1] << 8);
+            convert.step_index[ch] = std::min<uint8_t>(block[4 * ch + 2], 88);
+            sum += convert.predictor[ch];
+            continue;
+        }
+        size_t n = frame - 1;
+        uint8_t byte = block[4 * convert.channels * (1 + n / 8) + 4 * ch + (n % 8) / 2];
+        sum += imaDecodeNibble(convert, ch, n & 1 ? byte >> 4 : byte & 0x0F);
     }
+    return convert.channels == 2 ? sum >> 1 : sum;
+}
 
-    // Get file size and allocate buffer
-    size_t file_size = file.size();
-    if (file_size < 44) {
-        printf("Invalid WAV file (too small)\n");
-        file.close();
-
-        // Show error on screen
-        M5Cardputer.Display.setTextColor(RED);
-        M5Cardputer.Display.drawString("WAV file too small", 5, 90);
-        delay(2000);
-        return;
+// Load the next source frame into b, refilling from the clip as needed
+static inline bool nextWavFrame(File& file, WavConverter& convert) {
+    int32_t sample;
+    if (convert.format == wave_format_ima_adpcm) {
+        if (convert.block_frame >= convert.block_frames) {
+            if (!refillWavRaw(file, convert, convert.block_align)) return false;
+            convert.block_frames = imaBlockFrames(convert.raw_len, convert.channels);
+            convert.block_frame = 0;
+            if (convert.block_frames == 0) return false;
+        }
+        sample = imaFrameSample(convert);
+    } else {
+        if (convert.raw_pos >= convert.raw_len && !refillWavRaw(file, convert, wav_raw_bytes)) return false;
+        sample = wavFrameSample(convert.raw + convert.raw_pos, convert.channels, convert.bits);
+        convert.raw_pos += convert.channels * convert.bits / 8;
     }
+    convert.a = convert.b;
+    convert.b = sample;
+    return true;
+}
 
-    // Skip WAV header (44 bytes)
-    file.seek(44);
-    size_t audio_data_size = file_size - 44;
-
-    // Show "Playing..." message
-    M5Cardputer.Display.setTextColor(CYAN);
-    M5Cardputer.Display.drawString("Playing audio...", 5, 90);
+// Produce up to samples converted samples into out, reading the file as
+// needed. Returns fewer only at the end of the clip or on a read error.
+size_t convertWavSamples(File& file, WavConverter& convert, int16_t* out, size_t samples) {
+    size_t produced = 0;
+    while (produced < samples) {
+        if (convert.phase >= 0x10000) {
+            if (!nextWavFrame(file, convert)) break;
+            convert.phase -= 0x10000;
+            continue;
+        }
+        // Half the phase keeps (b - a) * fraction inside 32 bits
+        out[produced++] = convert.a + ((convert.b - convert.a) * (int32_t)(convert.phase >> 1) >> 15);
+        convert.phase += convert.step;
+    }
+    return produced;
+}
 
-    // Allocate buffer for audio data
-    int16_t* audio_buf = (int16_t*)heap_caps_malloc(audio_data_size, MALLOC_CAP_8BIT);
-    if (!audio_buf) {
-        printf("Failed to allocate audio buffer (%d bytes)\n", audio_data_size);
-        file.close();
+// Generate random seed from text input using DJB2 hash + timestamp
+uint32_t generateSeedFromText(const String& question) {
+    uint32_t hash = 5381;
+    for (size_t i = 0; i < question.length(); i++) {
+        hash = ((hash << 5) + hash) + tolower(question[i]);
+    }
+    hash ^= millis(); // Mix in timestamp
+    // Additional mixing for better distribution
+    hash ^= (hash >> 16);
+    hash *= 0x85ebca6b;
+    hash ^= (hash >> 13);
+    return hash;
+}
 
-        // Show error on screen
-        M5Cardputer.Display.setTextColor(RED);
-        M5Cardputer.Display.drawString("Memory allocation failed", 5, 90);
-        delay(2000);
-        return;
+// Integer square root, avoids the software double sqrt on the ESP32-S3
+static uint32_t isqrt64(uint64_t value) {
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > value) bit >>= 2;
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
     }
+    return (uint32_t)result;
+}
 
-    // Read audio data
-    size_t bytes_read = file.read((uint8_t*)audio_buf, audio_data_size);
-    file.close();
+// Fold a block of samples into the running features in one pass. Squares of
+// two samples always fit in 32 bits, so the 64-bit accumulator is only
+// touched once per pair, and the sign test for zero crossings is branchless.
+void accumulateAudioFeatures(AudioFeatures& features, const int16_t* audio_data, size_t num_samples) {
+    if (num_samples == 0) return;
 
-    if (bytes_read != audio_data_size) {
-        printf("Failed to read complete audio file\n");
-        free(audio_buf);
+    int32_t prev = (features.num_samples == 0) ? audio_data[0] : features.last_sample;
+    uint32_t peak = features.peak;
+    uint32_t crossings = 0;
+    uint64_t sum_squares = 0;
 
-        // Show error on screen
-        M5Cardputer.Display.setTextColor(RED);
-        M5Cardputer.Display.drawString("Failed to read audio", 5, 90);
-        delay(2000);
-        return;
-    }
+    size_t i = 0;
+    for (; i + 1 < num_samples; i += 2) {
+        int32_t a = audio_data[i];
+        int32_t b = audio_data[i + 1];
 
-    // Stop microphone and start speaker
-    M5Cardputer.Mic.end();
-    M5Cardputer.Speaker.begin();
-    M5Cardputer.Speaker.setVolume(255);
+        crossings += ((uint32_t)(prev ^ a) >> 31) + ((uint32_t)(a ^ b) >> 31);
+        prev = b;
 
-    // Play audio
-    size_t sample_count = audio_data_size / sizeof(int16_t);
-    printf("Playing audio: %s (%d samples)\n", wav_path.c_str(), sample_count);
-    M5Cardputer.Speaker.playRaw(audio_buf, sample_count, record_samplerate);
+        uint32_t abs_a = (a ^ (a >> 31)) - (a >> 31);
+        uint32_t abs_b = (b ^ (b >> 31)) - (b >> 31);
+        uint32_t abs_max = abs_a > abs_b ? abs_a : abs_b;
+        if (abs_max > peak) peak = abs_max;
 
-    // Wait for playback to complete
-    while (M5Cardputer.Speaker.isPlaying()) {
-        delay(10);
-        M5Cardputer.update(); // Allow button presses during playback
+        sum_squares += (uint32_t)(a * a) + (uint32_t)(b * b);
+    }
+    if (i < num_samples) {
+        int32_t a = audio_data[i];
+        crossings += (uint32_t)(prev ^ a) >> 31;
+        prev = a;
+        uint32_t abs_a = (a ^ (a >> 31)) - (a >> 31);
+        if (abs_a > peak) peak = abs_a;
+        sum_squares += (uint32_t)(a * a);
     }
 
-    // Clean up
-    M5Cardputer.Speaker.end();
-    free(audio_buf);
-    printf("Audio playback complete\n");
+    features.peak = peak > INT16_MAX ? INT16_MAX : peak;
+    features.zero_crossings += crossings;
+    features.sum_squares += sum_squares;
+    features.num_samples += num_samples;
+    features.last_sample = prev;
 }
 
-void setup(void)
-{
-    auto cfg = M5.config();
+// Combine accumulated audio features into a seed
+uint32_t generateSeedFromFeatures(const AudioFeatures& features) {
+    uint32_t seed = 0;
 
-    M5Cardputer.begin(cfg);
+    // Peak amplitude
+    seed ^= (uint32_t)features.peak;
+
+    // Zero-crossing count
+    seed ^= ((uint32_t)features.zero_crossings << 8);
+
+    // RMS energy
+    uint32_t rms = features.num_samples ? isqrt64(features.sum_squares / features.num_samples) : 0;
+    seed ^= (rms << 16);
+
+    seed ^= millis(); // Mix in timestamp
+    return seed;
+}
+
+// Generate random seed from audio waveform analysis
+uint32_t generateSeedFromAudio(int16_t* audio_data, size_t num_samples) {
+    AudioFeatures features;
+    accumulateAudioFeatures(features, audio_data, num_samples);
+    return generateSeedFromFeatures(features);
+}
+
+// Pick a response from a 32-bit seed. Multiply-shift maps the seed onto a
+// column: the top 32 bits of seed * n are the column and the bottom 32 bits
+// are the fraction for the alias coin flip, so together they are unbiased.
+uint16_t selectResponse(uint32_t seed) {
+    if (responses.size() == 0) return 0;
+
+    uint64_t scaled = (uint64_t)seed * responses.size();
+    uint16_t column = scaled >> 32;
+    if (column >= alias_threshold.size()) return column;
+    return (uint32_t)scaled < alias_threshold[column] ? column : alias_index[column];
+}
+
+// Vose's alias method: columns with less than the average weight are topped
+// up from one with more, so every column splits between at most two
+// responses. Runs once per load, O(n). The arithmetic is in double: with
+// tens of thousands of skewed weights, float drifts far enough to strand
+// columns or make weight-0 responses selectable.
+void buildAliasTable() {
+    size_t n = responses.size();
+    alias_threshold.assign(n, UINT32_MAX);
+    alias_index.resize(n);
+    for (size_t i = 0; i < n; i++) alias_index[i] = i;
+
+    double total = 0.0;
+    for (const Response& r : responses) total += r.weight;
+    if (n == 0 || !(total > 0.0)) {
+        printf("No positive weights, selecting uniformly\n");
+        return;
+    }
+
+    // Scale weights so the average column holds exactly 1
+    std::vector<double> scaled(n);
+    std::vector<uint16_t> small, large;
+    uint16_t heaviest = 0;
+    for (size_t i = 0; i < n; i++) {
+        scaled[i] = responses[i].weight * (double)n / total;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+        if (responses[i].weight > responses[heaviest].weight) heaviest = i;
+    }
+    while (!small.empty() && !large.empty()) {
+        uint16_t s = small.back();
+        uint16_t l = large.back();
+        small.pop_back();
+        alias_threshold[s] = (uint32_t)std::min(scaled[s] * 4294967296.0, 4294967295.0);
+        alias_index[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // Whatever is left is full up to rounding and keeps its own column,
+    // except a weight-0 response, which hands all of it to the heaviest
+    for (uint16_t l : large) {
+        alias_threshold[l] = UINT32_MAX;
+        alias_index[l] = l;
+    }
+    for (uint16_t s : small) {
+        bool empty = !(responses[s].weight > 0.0f);
+        alias_threshold[s] = empty ? 0 : UINT32_MAX;
+        alias_index[s] = empty ? heaviest : s;
+    }
+}
+
+// Build the advance table for the frame's current font. A glyph's advance is
+// what it adds in front of another one, which leaves out the overhang
+// textWidth() counts on the last glyph of a string.
+void updateGlyphAdvances() {
+    const lgfx::IFont* font = frame.getFont();
+    float text_size = frame.getTextSizeX();
+    if (glyph_advances.font == font && glyph_advances.text_size == text_size) return;
+
+    char pair[3] = {0, 0, 0};
+    for (int c = 0x20; c < 0x7F; c++) {
+        pair[0] = pair[1] = c;
+        int two = frame.textWidth(pair);
+        pair[1] = '\0';
+        glyph_advances.width[c - 0x20] = two - frame.textWidth(pair);
+    }
+    glyph_advances.font = font;
+    glyph_advances.text_size = text_size;
+
+    // Cached layouts were measured with the old widths
+    for (TextLayout& layout : answer_layouts) {
+        layout.idx = UINT16_MAX;
+    }
+}
+
+// Width of text[0, length) as print() advances the cursor. Anything outside
+// printable ASCII (UTF-8 sequences) is measured by the font instead.
+int glyphTextWidth(const char* text, size_t length) {
+    int width = 0;
+    size_t i = 0;
+    while (i < length) {
+        if (text[i] >= 0x20 && text[i] < 0x7F) {
+            width += glyph_advances.width[text[i++] - 0x20];
+            continue;
+        }
+        char buf[32];
+        size_t len = 0;
+        while (i < length && len < sizeof(buf) - 1 && !(text[i] >= 0x20 && text[i] < 0x7F)) {
+            buf[len++] = text[i++];
+        }
+        buf[len] = '\0';
+        width += frame.textWidth(buf);
+    }
+    return width;
+}
+
+// Wrap text into lines starting at x: a word moves to the next line when it
+// would cross max_width, unless it is first on its line; '\n' breaks a line
+void layoutText(const char* text, int x, int max_width, TextLayout& layout) {
+    updateGlyphAdvances();
+    int space_width = glyph_advances.width[0];
+    int cursor_x = x;
+    size_t line_start = 0;
+    size_t line_end = 0;
+    layout.line_count = 0;
+
+    auto endLine = [&](size_t next_start) {
+        if (layout.line_count < text_layout_max_lines) {
+            TextLine& line = layout.lines[layout.line_count++];
+            line.start = line_start;
+            line.length = line_end > line_start ? line_end - line_start : 0;
+        }
+        line_start = line_end = next_start;
+        cursor_x = x;
+    };
+
+    size_t i = 0;
+    for (;;) {
+        size_t j = i;
+        while (text[j] && text[j] != ' ' && text[j] != '\n') j++;
+
+        int word_width = glyphTextWidth(text + i, j - i);
+        if (cursor_x + word_width > max_width && cursor_x > x) {
+            endLine(i);
+        }
+        cursor_x += word_width;
+        if (j > i) line_end = j;
+
+        if (text[j] == '\0') break;
+        if (text[j] == '\n') {
+            endLine(j + 1);
+        } else {
+            cursor_x += space_width;
+        }
+        i = j + 1;
+    }
+    if (line_end > line_start) endLine(line_end);
+}
+
+// Draw a layout's lines, one write per line
+void drawTextLayout(const char* text, const TextLayout& layout, int x, int y, int line_height) {
+    for (size_t k = 0; k < layout.line_count; k++) {
+        const TextLine& line = layout.lines[k];
+        if (line.length == 0) continue;
+        frame.setCursor(x, y + k * line_height);
+        frame.write((const uint8_t*)text + line.start, line.length);
+    }
+}
+
+// Layout of response idx's answer text, wrapped on first use
+const TextLayout& answerLayout(uint16_t idx, int max_width) {
+    updateGlyphAdvances();
+    TextLayout& layout = answer_layouts[idx % answer_layout_slots];
+    if (layout.idx != idx || layout.max_width != max_width) {
+        layoutText(responses[idx].text.c_str(), 5, max_width, layout);
+        layout.idx = idx;
+        layout.max_width = max_width;
+    }
+    return layout;
+}
+
+// Helper function to draw wrapped text
+void drawWrappedText(const char* text, int x, int y, int max_width, int line_height) {
+    static TextLayout layout;
+    layoutText(text, x, max_width, layout);
+    drawTextLayout(text, layout, x, y, line_height);
+}
+
+// Returns true (and books the next slot) when the current state's frame
+// interval has elapsed
+bool frameDue() {
+    unsigned long now = millis();
+    uint16_t interval = state_pacing[current_state].frame_ms;
+    if (interval == 0 || (long)(now - next_frame_time) < 0) {
+        return false;
+    }
+    // Don't try to catch up on frames missed while busy
+    next_frame_time = (now - next_frame_time >= interval) ? now + interval : next_frame_time + interval;
+    return true;
+}
+
+// Yield the CPU until the next poll is due, or input_task has new events.
+// Entering a state draws its first frame directly, so the frame clock
+// restarts on a state change.
+void waitForNextPoll() {
+    unsigned long now = millis();
+    if (paced_state != current_state) {
+        paced_state = current_state;
+        next_frame_time = now + state_pacing[current_state].frame_ms;
+    }
+
+    uint16_t interval = power_mode == POWER_ACTIVE ? state_pacing[current_state].poll_ms : idle_power_poll_ms;
+    next_poll_time += interval;
+    if ((long)(now - next_poll_time) >= 0 || (long)(next_poll_time - now) > interval) {
+        next_poll_time = now + interval;
+    }
+    // New input ends the wait early
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(next_poll_time - now));
+}
+
+// Display idle screen with prompt
+void displayIdle() {
+    waitFramePush();
+    frame.clear();
+    frame.setTextDatum(top_left);
+    frame.setTextSize(1);
+
+    frame.setTextColor(WHITE);
+    frame.drawString("MAGIC EIGHT BALL", 5, 5);
+
+    frame.setTextColor(CYAN);
+    frame.drawString("Type your question", 5, 30);
+    frame.drawString("Press Enter or [Go]", 5, 45);
+
+    frame.setTextColor(YELLOW);
+    frame.drawString("Press [Go] for voice", 5, 70);
+    pushFrame();
+}
+
+// The frame buffer rows the overlay sits on
+static uint8_t* overlayBand() {
+    size_t pixel_bytes = frame_dma ? sizeof(uint16_t) : 1;
+    return (uint8_t*)frame.getBuffer() + (frame.height() - overlay_height) * frame.width() * pixel_bytes;
+}
+
+static size_t overlayBandBytes() {
+    return overlay_height * frame.width() * (frame_dma ? sizeof(uint16_t) : 1);
+}
+
+// Draw the overlay into frame ahead of a push of rows [y, y + h), keeping
+// what it covers for waitFramePush() to restore
+static void stampProfileOverlay(int y, int h) {
+    int band_y = frame.height() - overlay_height;
+    if (!overlay.visible || y + h <= band_y) return;
+
+    memcpy(overlay.under, overlayBand(), overlayBandBytes());
+    overlay.stamped = true;
+
+    const lgfx::IFont* font = frame.getFont();
+    float text_size = frame.getTextSizeX();
+    frame.setFont(&fonts::Font0);
+    frame.setTextSize(1);
+    frame.setTextDatum(top_left);
+    frame.fillRect(0, band_y, frame.width(), overlay_height, BLACK);
+    frame.drawFastHLine(0, band_y, frame.width(), GREEN);
+    frame.setTextColor(GREEN);
+    for (int i = 0; i < 4; i++) {
+        frame.drawString(overlay.lines[i], 2, band_y + 2 + i * 8);
+    }
+    frame.setFont(font);
+    frame.setTextSize(text_size);
+}
+
+// Start a DMA push of the whole frame. The 8bpp fallback frame needs
+// converting on the way out, so it goes out synchronously.
+void pushFrame() {
+    ProfileScope timer(PROF_FRAME_PUSH);
+    waitFramePush();
+    stampProfileOverlay(0, frame.height());
+    if (!frame_dma) {
+        frame.pushSprite(0, 0);
+        return;
+    }
+    M5Cardputer.Display.pushImageDMA(0, 0, frame.width(), frame.height(), (const lgfx::swap565_t*)frame.getBuffer());
+}
+
+// Push part of the frame. Full-width bands are contiguous in the buffer and
+// go out by DMA; anything narrower is small enough to push synchronously,
+// with the panel clip limiting the transfer to the region.
+static void pushRegion(int x, int y, int w, int h) {
+    waitFramePush();
+    stampProfileOverlay(y, h);
+    if (x == 0 && w == frame.width() && frame_dma) {
+        const lgfx::swap565_t* buffer = (const lgfx::swap565_t*)frame.getBuffer();
+        M5Cardputer.Display.pushImageDMA(0, y, w, h, buffer + y * w);
+        return;
+    }
+    M5Cardputer.Display.setClipRect(x, y, w, h);
+    frame.pushSprite(0, 0);
+    M5Cardputer.Display.clearClipRect();
+}
+
+void pushFrameRegion(int x, int y, int w, int h) {
+    ProfileScope timer(PROF_FRAME_PUSH);
+    pushRegion(x, y, w, h);
+}
+
+// Also puts back the pixels a stamped overlay covered, once the push that
+// showed it is done with them
+void waitFramePush() {
+    M5Cardputer.Display.waitDMA();
+    if (overlay.stamped) {
+        memcpy(overlayBand(), overlay.under, overlayBandBytes());
+        overlay.stamped = false;
+    }
+}
+
+
+// Width of text[start, end) from the glyph advance table
+static int questionTextWidth(const String& text, size_t start, size_t end) {
+    return glyphTextWidth(text.c_str() + start, end - start);
+}
+
+// Wrap one line starting at offset start, same rules as drawWrappedText().
+// Returns where the next line starts; end_x gets the x after the last word.
+static size_t wrapQuestionLine(const String& text, size_t start, int max_width, int* end_x) {
+    int cursor_x = question_x;
+    updateGlyphAdvances();
+    int space_width = glyph_advances.width[0];
+    size_t i = start;
+    while (i < text.length()) {
+        size_t j = i;
+        while (j < text.length() && text[j] != ' ' && text[j] != '\n') j++;
+
+        int word_width = questionTextWidth(text, i, j);
+        if (cursor_x + word_width > max_width && cursor_x > question_x) {
+            break;
+        }
+        cursor_x += word_width;
+
+        if (j >= text.length()) {
+            i = j;
+            break;
+        }
+        if (text[j] == '\n') {
+            i = j + 1;
+            cursor_x = question_x;
+            break;
+        }
+        cursor_x += space_width;
+        i = j + 1;
+    }
+    *end_x = cursor_x;
+    return i;
+}
+
+// Re-wrap the question from a given line onwards. Edits only happen at the
+// end of the text, so the first changed line is the old last line, the new
+// last line, or the first one whose start moved, whichever comes first.
+static size_t layoutQuestionFrom(const String& text, size_t line) {
+    int max_width = frame.width() - 10;
+    size_t old_count = question_lines.size();
+    if (line >= old_count) line = old_count ? old_count - 1 : 0;
+
+    size_t first_changed = old_count ? old_count - 1 : 0;
+    size_t start = line < old_count ? question_lines[line] : 0;
+    for (;;) {
+        if (line < old_count) {
+            if (question_lines[line] != start) first_changed = std::min(first_changed, line);
+            question_lines[line] = start;
+        } else {
+            question_lines.push_back(start);
+        }
+
+        size_t next = wrapQuestionLine(text, start, max_width, &question_cursor_x);
+        bool ended_with_newline = next > start && text[next - 1] == '\n';
+        if (next >= text.length() && !ended_with_newline) break;
+        start = next;
+        line++;
+    }
+    question_lines.resize(line + 1);
+
+    // A cursor that would run past the edge moves to the start of the next line
+    question_cursor_y = question_y + line * question_line_height;
+    if (question_cursor_x + frame.textWidth("_") > max_width) {
+        question_cursor_x = question_x;
+        question_cursor_y += question_line_height;
+    }
+    return std::min(first_changed, line);
+}
+
+// Draw wrapped question line k at its stored position
+static void drawQuestionLine(const String& text, size_t k) {
+    size_t start = question_lines[k];
+    size_t end = k + 1 < question_lines.size() ? question_lines[k + 1] : text.length();
+    int cursor_x = question_x;
+    int cursor_y = question_y + k * question_line_height;
+    updateGlyphAdvances();
+    int space_width = glyph_advances.width[0];
+
+    size_t i = start;
+    while (i < end) {
+        size_t j = i;
+        while (j < end && text[j] != ' ' && text[j] != '\n') j++;
+        int word_width = questionTextWidth(text, i, j);
+        if (j > i) {
+            frame.setCursor(cursor_x, cursor_y);
+            frame.write((const uint8_t*)text.c_str() + i, j - i);
+        }
+        cursor_x += word_width + space_width;
+        i = j + 1;
+    }
+}
+
+// Repaint a rectangle of the text input screen into the frame. Only elements
+// whose glyph box overlaps the rectangle are drawn, clipped to it.
+static void paintTextInputRegion(const String& question, int x, int y, int w, int h) {
+    waitFramePush();
+    frame.setClipRect(x, y, w, h);
+    frame.fillRect(x, y, w, h, BLACK);
+    frame.setTextDatum(top_left);
+    frame.setTextSize(1);
+    int font_height = frame.fontHeight();
+
+    if (y < 5 + font_height) {
+        frame.setTextColor(WHITE);
+        frame.drawString("Your Question:", 5, 5);
+    }
+
+    frame.setTextColor(CYAN);
+    for (size_t k = 0; k < question_lines.size(); k++) {
+        int line_y = question_y + k * question_line_height;
+        if (line_y + font_height > y && line_y < y + h) {
+            drawQuestionLine(question, k);
+        }
+    }
+    if (cursor_visible) {
+        frame.drawString("_", question_cursor_x, question_cursor_y);
+    }
+
+    if (y + h > 110) {
+        frame.setTextColor(YELLOW);
+        frame.drawString("Enter or [Go] to submit", 5, 110);
+    }
+    frame.clearClipRect();
+}
+
+// Display text input with blinking cursor
+void displayTextInput(const String& question) {
+    question_lines.clear();
+    layoutQuestionFrom(question, 0);
+    paintTextInputRegion(question, 0, 0, frame.width(), frame.height());
+    pushFrame();
+}
+
+// After an edit, re-wrap from the last line (or the one before it, which a
+// shortened word may now fit on) and repaint from the first changed line.
+// A deletion can leave lines starting at or past the end of the text; they
+// are skipped so the re-wrap starts before them.
+void updateTextInput(const String& question) {
+    size_t count = question_lines.size();
+    while (count > 1 && question_lines[count - 1] >= question.length()) count--;
+    size_t from = count >= 2 ? count - 2 : 0;
+    size_t first = layoutQuestionFrom(question, from);
+
+    int y = question_y + first * question_line_height;
+    paintTextInputRegion(question, 0, y, frame.width(), frame.height() - y);
+    pushFrameRegion(0, y, frame.width(), frame.height() - y);
+}
+
+// Toggle the cursor by repainting its cell only
+void blinkTextInputCursor() {
+    int x = question_cursor_x;
+    int y = question_cursor_y;
+    int w = frame.textWidth("_");
+    int h = frame.fontHeight();
+    paintTextInputRegion(current_question, x, y, w, h);
+    pushFrameRegion(x, y, w, h);
+}
+
+// Display voice recording progress with waveform
+void displayVoiceInput(int progress) {
+    waitFramePush();
+    frame.clear();
+    frame.setTextDatum(top_left);
+    frame.setTextSize(1);
+
+    frame.setTextColor(WHITE);
+    frame.drawString("Recording...", 5, 5);
+
+    // Progress bar
+    int bar_width = (frame.width() - 20) * progress / 100;
+    frame.fillRect(5, 30, bar_width, 10, GREEN);
+    frame.drawRect(5, 30, frame.width() - 10, 10, WHITE);
+    pushFrame();
+
+    // Start the waveform from an empty trace
+    wave_sprite.fillScreen(BLACK);
+    memset(prev_h, 0, sizeof(prev_h));
+    updateVoiceInput(progress);
+}
+
+// Draw the min/max envelope of the newest chunks as one vertical span per
+// column, erasing each column's previous span rather than the whole sprite
+static void drawVoiceWaveform() {
+    size_t chunks = std::min(wave_window_chunks, draw_record_idx + 1);
+    size_t first = draw_record_idx + 1 - chunks;
+    const int16_t* window[wave_window_chunks];
+    for (size_t c = 0; c < chunks; c++) {
+        window[c] = voiceChunk(first + c);
+    }
+
+    size_t total = chunks * record_length;
+    int columns = std::min<int>(wave_sprite.width(), record_length);
+    int center = wave_height / 2;
+    size_t i = 0;
+    for (int x = 0; x < columns; x++) {
+        size_t end = (x + 1) * total / columns;
+        int32_t lo = INT16_MAX;
+        int32_t hi = INT16_MIN;
+        for (; i < end; i++) {
+            int32_t sample = window[i / record_length][i % record_length];
+            if (sample < lo) lo = sample;
+            if (sample > hi) hi = sample;
+        }
+
+        // Scale so half of full-scale reaches the sprite edge
+        int y_top = std::max(0, std::min(wave_height - 1, center - (int)(hi * center / 16384)));
+        int y_bot = std::max(0, std::min(wave_height - 1, center - (int)(lo * center / 16384)));
+        int h = y_bot - y_top + 1;
+
+        if (prev_y[x] != y_top || prev_h[x] != h) {
+            if (prev_h[x] > 0) {
+                wave_sprite.drawFastVLine(x, prev_y[x], prev_h[x], BLACK);
+            }
+            wave_sprite.drawFastVLine(x, y_top, h, CYAN);
+            prev_y[x] = y_top;
+            prev_h[x] = h;
+        }
+    }
+}
+
+// Update the progress bar and waveform without recomposing the screen
+void updateVoiceInput(int progress) {
+    waitFramePush();
+    int bar_width = (frame.width() - 20) * progress / 100;
+    frame.fillRect(5, 30, bar_width, 10, GREEN);
+    pushFrameRegion(5, 30, frame.width() - 10, 10);
+
+    drawVoiceWaveform();
+    wave_sprite.pushSprite(0, wave_y);
+    if (overlay.visible) {
+        pushRegion(0, frame.height() - overlay_height, frame.width(), overlay_height);
+    }
+}
+
+// Display thinking animation
+void displayThinking() {
+    waitFramePush();
+    frame.clear();
+    frame.setTextDatum(top_left);
+    frame.setTextSize(1);
+    frame.setTextColor(MAGENTA);
+
+    // Animate dots based on time
+    String dots = "";
+    int dot_count = (millis() / 500) % 4;
+    for (int i = 0; i < dot_count; i++) {
+        dots += ".";
+    }
+
+    frame.drawString("Thinking" + dots, 5, frame.height() / 2 - 10);
+    pushFrame();
+}
+
+void displayCatalogError() {
+    waitFramePush();
+    frame.clear();
+    frame.setTextDatum(top_left);
+    frame.setTextSize(1);
+
+    frame.setTextColor(RED);
+    frame.drawString("SD CARD ERROR", 5, 5);
+    frame.setTextColor(WHITE);
+    drawWrappedText(catalog_error, 5, 30, frame.width() - 10, 15);
+    pushFrame();
+}
+
+// Open an asset from SD, trying the path as-is first and then with a
+// leading slash, since responses.json paths are relative to the SD root
+File openAssetFile(const char* path) {
+    ProfileScope timer(PROF_SD_OPEN);
+    File file = SD.open(path);
+    if (!file && path[0] != '/') {
+        String alt_path = "/";
+        alt_path += path;
+        file = SD.open(alt_path.c_str());
+    }
+    return file;
+}
+
+// Open a BMP and parse its headers, leaving the file positioned at the pixels
+bool openBitmap(const char* bitmap_path, File& file, BmpInfo& info) {
+    file = openAssetFile(bitmap_path);
+    if (!file) {
+        printf("Bitmap not found: %s\n", bitmap_path);
+        return false;
+    }
+
+    // File header (14 bytes) + BITMAPINFOHEADER (40 bytes) + bitfield masks
+    uint8_t header[66];
+    size_t header_size = file.read(header, sizeof(header));
+    if (header_size < 54 || header[0] != 'B' || header[1] != 'M') {
+        printf("Invalid BMP file: %s\n", bitmap_path);
+        file.close();
+        return false;
+    }
+
+    uint32_t dib_size = readLE32(header + 14);
+    int32_t height = (int32_t)readLE32(header + 22);
+    uint32_t compression = readLE32(header + 30);
+    info.width = (int32_t)readLE32(header + 18);
+    info.height = height < 0 ? -height : height;
+    info.top_down = height < 0;
+    info.bpp = readLE16(header + 28);
+    info.data_offset = readLE32(header + 10);
+    info.row_stride = ((info.width * info.bpp + 31) / 32) * 4;
+
+    // 16bpp is X1R5G5B5 unless bitfield masks say R5G6B5. The masks follow a
+    // 40-byte header, or sit at the same offset inside V4/V5 headers.
+    info.rgb555 = false;
+    if (info.bpp == 16) {
+        info.rgb555 = true;
+        if (compression == 3 && header_size >= 66 && (dib_size >= 52 || info.data_offset >= 66)) {
+            info.rgb555 = readLE32(header + 58) != 0x07E0;  // Green mask
+        }
+    }
+
+    bool supported = (info.bpp == 24 && compression == 0) ||
+                     (info.bpp == 16 && (compression == 0 || compression == 3));
+    if (!supported || info.width <= 0 || info.height == 0 || info.row_stride > bmp_chunk_bytes) {
+        printf("Unsupported BMP (%dx%d, %d bpp, compression %d): %s\n",
+               info.width, info.height, info.bpp, compression, bitmap_path);
+        file.close();
+        return false;
+    }
+
+    file.seek(info.data_offset);
+    return true;
+}
+
+// Stream pixel rows from the file into the frame. Rows are read in file order
+// (bottom-up unless top_down), several per SD read, starting at first_row
+// when the earlier ones have already been drawn from the prefetch buffer.
+bool drawBitmap(File& file, const BmpInfo& info, int x, int y, int32_t first_row, uint16_t* cache_pixels) {
+    size_t rows_per_chunk = bmp_chunk_bytes / info.row_stride;
+    int32_t row = first_row;
+    while (row < info.height) {
+        size_t rows = std::min<size_t>(rows_per_chunk, info.height - row);
+        size_t bytes = rows * info.row_stride;
+        if (readSD(file, bmp_chunk, bytes) != bytes) {
+            printf("Failed to read bitmap rows\n");
+            return false;
+        }
+        drawBitmapRows(info, bmp_chunk, row, rows, x, y, cache_pixels);
+        row += rows;
+    }
+    return true;
+}
+
+// Push rows already in memory, one at a time since each carries its own
+// padding. Rows are converted to RGB565 in place (the output never overtakes
+// the input), and copied top-down into cache_pixels when it is given.
+void drawBitmapRows(const BmpInfo& info, uint8_t* rows_data, int32_t first_row, size_t rows, int x, int y,
+                    uint16_t* cache_pixels) {
+    for (size_t r = 0; r < rows; r++) {
+        int32_t row = first_row + r;
+        uint8_t* pixels = rows_data + r * info.row_stride;
+        uint16_t* px = (uint16_t*)pixels;
+        int32_t image_y = info.top_down ? row : info.height - 1 - row;
+        if (info.bpp == 24) {
+            // BMP stores B,G,R
+            for (int32_t i = 0; i < info.width; i++) {
+                const uint8_t* bgr = pixels + i * 3;
+                px[i] = ((bgr[2] & 0xF8) << 8) | ((bgr[1] & 0xFC) << 3) | (bgr[0] >> 3);
+            }
+        } else if (info.rgb555) {
+            for (int32_t i = 0; i < info.width; i++) {
+                uint16_t v = px[i];
+                uint16_t g = (v >> 5) & 0x1F;
+                px[i] = ((v & 0x7C00) << 1) | (((g << 1) | (g >> 4)) << 5) | (v & 0x1F);
+            }
+        }
+        frame.pushImage(x, y + image_y, info.width, 1, (const lgfx::rgb565_t*)px);
+        if (cache_pixels) {
+            memcpy(cache_pixels + image_y * info.width, px, info.width * sizeof(uint16_t));
+        }
+    }
+}
+
+// Open a response's bitmap at its first row, using the format recorded in
+// the catalog instead of re-parsing the BMP header. Packed pixels are a
+// top-down R5G6B5 image, so they share the row streaming and caching.
+bool openResponseBitmap(uint16_t idx, File& file, BmpInfo& info) {
+    if (idx >= catalog_assets.size()) return false;
+
+    const AssetEntry& asset = catalog_assets[idx];
+    if (asset.width == 0 || asset.height == 0) return false;
+
+    info = BmpInfo();
+    info.width = asset.width;
+    info.height = asset.height;
+    info.bpp = asset.bpp;
+    info.top_down = asset.pixel_flags & pixel_top_down;
+    info.rgb555 = asset.pixel_flags & pixel_rgb555;
+    info.data_offset = asset.pixels_offset;
+    info.row_stride = ((info.width * info.bpp + 31) / 32) * 4;
+    if (info.row_stride > bmp_chunk_bytes) return false;
+
+    file = openAssetFile(assets_packed ? pack_path : responses[idx].bitmap_path.c_str());
+    if (!file) return false;
+    if (file.size() < (uint64_t)info.data_offset + (uint64_t)info.row_stride * info.height) {
+        printf("Stale index entry for %s\n", responses[idx].bitmap_path.c_str());
+        file.close();
+        return false;
+    }
+    file.seek(info.data_offset);
+    return true;
+}
+
+// Decode a BMP from SD into the frame at (x, y)
+bool displayBitmap(const char* bitmap_path, int x, int y) {
+    if (bitmap_path[0] == '\0') return false;
+
+    File file;
+    BmpInfo info;
+    if (!openBitmap(bitmap_path, file, info)) return false;
+    bool ok = drawBitmap(file, info, x, y);
+    file.close();
+    return ok;
+}
+
+// Claim the answer's bitmap: decoded pixels from the cache, the file the
+// prefetch opened, or a fresh open. Everything here that touches the
+// prefetch or the asset cache is done before AUDIO_PLAY goes out, since
+// playback fills the cache from audio_task; drawing only writes into the
+// pixels already allocated for this response.
+void takeAnswerBitmap(uint16_t idx, AnswerBitmap& bitmap) {
+    bitmap = AnswerBitmap();
+    if (idx >= responses.size()) return;
+
+    bitmap.cached = findCachedAsset(idx);
+    bitmap.from_cache = bitmap.cached && bitmap.cached->pixels_ready;
+    if (!bitmap.from_cache && !responses[idx].bitmap_path.isEmpty()) {
+        asset_cache.misses++;
+    }
+    if (bitmap.from_cache) {
+        asset_cache.hits++;
+        bitmap.info.width = bitmap.cached->width;
+        bitmap.info.height = bitmap.cached->height;
+        bitmap.have = true;
+        return;
+    }
+    if (prefetch.idx == idx && prefetch.step > PREFETCH_BMP_OPEN) {
+        bitmap.have = prefetch.bmp_file;
+        bitmap.file = prefetch.bmp_file;
+        bitmap.info = prefetch.bmp;
+        bitmap.ready_rows = prefetch.bmp_rows;
+        prefetch.bmp_file = File();
+        prefetch.bmp_rows = 0;
+    } else if (!responses[idx].bitmap_path.isEmpty()) {
+        bitmap.have = openResponseBitmap(idx, bitmap.file, bitmap.info);
+    }
+    if (!bitmap.have || !bitmap.cached) return;
+
+    // Keep the decoded pixels for next time if the budget allows. A decode
+    // that failed last time left its pixels unready; reuse the slot.
+    freeCachedPixels(*bitmap.cached);
+    size_t pixel_bytes = bitmap.info.width * bitmap.info.height * sizeof(uint16_t);
+    bitmap.pixels = (uint16_t*)allocCachedBytes(idx, pixel_bytes);
+    if (bitmap.pixels) {
+        bitmap.cached->pixels = bitmap.pixels;
+        bitmap.cached->pixel_bytes = pixel_bytes;
+        bitmap.cached->width = bitmap.info.width;
+        bitmap.cached->height = bitmap.info.height;
+    }
+}
+
+void displayAnswer(uint16_t idx) {
+    AnswerBitmap bitmap;
+    takeAnswerBitmap(idx, bitmap);
+    displayAnswer(idx, bitmap);
+}
+
+// Display answer with audio/bitmap indicators. Small images sit to the right
+// of the text; anything wider is centred behind it.
+void displayAnswer(uint16_t idx, AnswerBitmap& bitmap) {
+    if (idx >= responses.size()) return;
+    ProfileScope timer(PROF_DISPLAY_ANSWER);
+
+    waitFramePush();
+    frame.clear();
+    frame.setTextDatum(top_left);
+    frame.setTextSize(1);
+
+    int text_width = frame.width() - 10;
+    const BmpInfo& bmp = bitmap.info;
+    if (bitmap.have) {
+        int bmp_x = (frame.width() - bmp.width) / 2;
+        int bmp_y = (frame.height() - bmp.height) / 2;
+        if (bmp.width <= frame.width() / 3) {
+            bmp_x = frame.width() - bmp.width - 5;
+            bmp_y = 5;
+            text_width -= bmp.width + 5;
+        }
+
+        if (bitmap.from_cache) {
+            frame.pushImage(bmp_x, bmp_y, bmp.width, bmp.height, (const lgfx::rgb565_t*)bitmap.cached->pixels);
+        } else {
+            drawBitmapRows(bmp, bmp_prefetch, 0, bitmap.ready_rows, bmp_x, bmp_y, bitmap.pixels);
+            bool complete = drawBitmap(bitmap.file, bmp, bmp_x, bmp_y, bitmap.ready_rows, bitmap.pixels);
+            bitmap.file.close();
+            // An incomplete decode stays allocated but unready, freed when
+            // the slot is next claimed or evicted
+            if (bitmap.pixels && complete) {
+                bitmap.cached->pixels_ready = true;
+            }
+        }
+    }
+
+    frame.setTextColor(GREEN);
+    frame.drawString(responses[idx].wav_path.isEmpty() ? "Answer:" : "Answer: [AUDIO]", 5, 5);
+
+    frame.setTextColor(WHITE);
+    drawTextLayout(responses[idx].text.c_str(), answerLayout(idx, text_width), 5, 25, 15);
+
+    frame.setTextColor(YELLOW);
+    frame.drawString("Press [Go] to continue", 5, 110);
+    pushFrame();
+}
+
+// Ring slot holding a recorded chunk
+int16_t* voiceChunk(size_t chunk_idx) {
+    return &rec_data[(chunk_idx % rec_ring_chunks) * record_length];
+}
+
+// Hand every free ring slot to the mic and fold each filled chunk into
+// voice_features as soon as it lands. Mic.record() only queues the buffer;
+// isRecording() reports how many queued buffers are still pending, so every
+// chunk before those is complete. A slot is only reused once its chunk has
+// been analysed.
+void queueVoiceChunks() {
+    for (;;) {
+        size_t filled = rec_record_idx - M5Cardputer.Mic.isRecording();
+        while (rec_analyze_idx < filled) {
+            uint64_t sum_squares = voice_features.sum_squares;
+            uint16_t crossings = voice_features.zero_crossings;
+            accumulateAudioFeatures(voice_features, voiceChunk(rec_analyze_idx), record_length);
+            updateVoiceActivity(rec_analyze_idx,
+                                voice_features.sum_squares - sum_squares,
+                                voice_features.zero_crossings - crossings);
+            rec_analyze_idx++;
+        }
+
+        if (rec_record_idx >= rec_chunk_limit || M5Cardputer.Mic.isRecording() >= 2) {
+            break;
+        }
+        bool queued;
+        {
+            ProfileScope timer(PROF_MIC_RECORD);
+            queued = M5Cardputer.Mic.record(voiceChunk(rec_record_idx), record_length, record_samplerate);
+        }
+        if (!queued) {
+            break;
+        }
+        rec_record_idx++;
+    }
+}
+
+// Classify one analysed chunk from its energy and zero crossings, and lower
+// rec_chunk_limit once the question has clearly ended
+void updateVoiceActivity(size_t chunk_idx, uint64_t chunk_sum_squares, uint16_t chunk_crossings) {
+    if (!vad_enabled) return;
+
+    VoiceActivity& vad = voice_activity;
+    uint32_t energy = chunk_sum_squares / record_length;
+    if (chunk_idx == 0) {
+        // Capped so a user who starts talking immediately isn't taken as noise
+        vad.noise_floor = std::min(energy, vad_min_energy);
+    }
+
+    // Voiced speech is loud; fricatives are quieter but cross zero often
+    uint32_t threshold = std::max(vad_min_energy, vad.noise_floor * vad_noise_ratio);
+    bool voiced = energy > threshold;
+    bool fricative = energy > threshold / 4 && chunk_crossings > record_length / 4;
+    bool speech = voiced || fricative;
+
+    if (speech) {
+        if (!vad.speech_started) {
+            vad.speech_started = true;
+            vad.onset_chunk = chunk_idx;
+            // The full recording window starts at speech onset
+            rec_chunk_limit = std::min(rec_chunk_limit, chunk_idx + record_number);
+        }
+        vad.speech_chunks++;
+        vad.silent_chunks = 0;
+    } else {
+        // Track the background level so a noisy room doesn't count as speech
+        vad.noise_floor = (vad.noise_floor * 7 + energy) / 8;
+        if (vad.speech_started) {
+            vad.silent_chunks++;
+        }
+        if (vad.speech_started && vad.speech_chunks < vad_min_speech && vad.silent_chunks >= vad_trailing_silence) {
+            // Too short to be a question (a click or a bump): wait for a
+            // real onset again, with the window it would have had
+            vad.speech_started = false;
+            vad.speech_chunks = 0;
+            vad.silent_chunks = 0;
+            rec_chunk_limit = vad_wait_for_onset ? vad_onset_timeout + record_number : record_number;
+        }
+    }
+
+    bool question_ended = vad.speech_started && vad.speech_chunks >= vad_min_speech &&
+                          vad.silent_chunks >= vad_trailing_silence;
+    bool gave_up = !vad.speech_started && chunk_idx + 1 >= vad_onset_timeout;
+    if ((question_ended || gave_up) && rec_chunk_limit > rec_record_idx) {
+        // Stop queueing, the chunks already handed to the mic still complete
+        rec_chunk_limit = std::min(rec_chunk_limit, rec_record_idx);
+        printf("VAD: %s after %d chunks\n", question_ended ? "speech ended" : "no speech", chunk_idx + 1);
+    }
+}
+
+// Start streaming response audio from SD card, returns false if nothing plays
+bool playResponseAudio(uint16_t idx) {
+    if (idx >= responses.size() || responses[idx].wav_path.isEmpty()) {
+        printf("No audio file specified\n");
+        return false;
+    }
+    const char* wav_path = responses[idx].wav_path.c_str();
+    playback.idx = idx;
+    playback.source = nullptr;
+    playback.fill = nullptr;
+    playback.convert = WavConverter();
+
+    // Cached clips play straight from memory, encoded ones through the
+    // converter
+    CachedAsset* cached = findCachedAsset(idx);
+    if (cached && cached->pcm_ready) {
+        asset_cache.hits++;
+        playback.ready = 0;
+        if (catalog_assets[idx].audio_format == wave_format_ima_adpcm) {
+            playback.remaining = startWavConverter(playback.convert, catalog_assets[idx]);
+            playback.convert.memory = (const uint8_t*)cached->pcm;
+        } else {
+            playback.source = cached->pcm;
+            playback.remaining = cached->pcm_bytes;
+        }
+        return startResponseAudio(wav_path);
+    }
+    asset_cache.misses++;
+
+    // THINKING normally leaves the file open with the first chunks read
+    if (prefetch.wav_file && prefetch.idx == idx) {
+        playback.file = prefetch.wav_file;
+        playback.remaining = prefetch.wav_remaining;
+        playback.ready = prefetch.wav_ready;
+        playback.convert = prefetch.wav_convert;
+        prefetch.wav_file = File();
+        prefetch.wav_ready = 0;
+        prefetch.wav_convert.copy_to = nullptr;
+        return startResponseAudio(wav_path);
+    }
+
+    if (!openResponseAudio(idx, playback.file, playback.remaining, playback.convert)) {
+        printf("Audio file not found: %s\n", wav_path);
+        postAudioEvent({AUDIO_PLAY_FAILED, 0, AUDIO_FILE_NOT_FOUND});
+        return false;
+    }
+    playback.ready = 0;
+    return startResponseAudio(wav_path);
+}
+
+// Switch to the speaker and queue the first chunks of an opened clip
+bool startResponseAudio(const char* wav_path) {
+    postAudioEvent({AUDIO_PLAY_STARTED, 0, playback.source || playback.convert.memory ? 1u : 0u});
+
+    // Normally already switched when THINKING started
+    useAudioDevice(AUDIO_DEVICE_SPEAKER);
+
+    printf("Playing audio: %s (%d samples)%s\n", wav_path, playback.remaining / sizeof(int16_t),
+           playback.source || playback.convert.memory ? " from cache" : "");
+
+    // Copy a streamed clip into the cache as it plays, if the budget allows.
+    // Encoded clips are copied as read instead, see openResponseAudio().
+    playback.filled = 0;
+    if (playback.convert.copy_to) {
+        playback.fill = (int16_t*)playback.convert.copy_to;
+    } else if (!playback.source && !playback.convert.memory) {
+        CachedAsset* cached = findCachedAsset(playback.idx);
+        if (cached && !cached->pcm) {
+            cached->pcm = (int16_t*)allocCachedBytes(playback.idx, playback.remaining);
+            if (cached->pcm) {
+                cached->pcm_bytes = playback.remaining;
+                playback.fill = cached->pcm;
+            }
+        }
+    }
+
+    playback.buf_idx = 0;
+    playback.active = true;
+
+    // Queue the first chunks right away so the first sample plays immediately
+    return updateResponseAudio();
+}
+
+// Read the clip's next chunk into the next play buffer, or take the one the
+// prefetch already filled. Returns the bytes read, 0 at the end of the clip
+// or after a read error, which is reported and ends it.
+static size_t readResponseChunk(int16_t*& buf) {
+    buf = play_buffers[playback.buf_idx];
+    size_t chunk_size = std::min(playback.remaining, play_chunk_samples * sizeof(int16_t));
+    if (chunk_size == 0) return 0;
+
+    size_t bytes_read = chunk_size;
+    if (playback.ready > 0) {
+        playback.ready--;
+    } else {
+        ProfileScope timer(PROF_WAV_READ);
+        bytes_read = playback.convert.active
+            ? convertWavSamples(playback.file, playback.convert, buf, chunk_size / sizeof(int16_t)) *
+              sizeof(int16_t)
+            : readSD(playback.file, buf, chunk_size);
+    }
+    if (bytes_read != chunk_size) {
+        printf("Failed to read complete audio file\n");
+        postAudioEvent({AUDIO_PLAY_FAILED, 0, AUDIO_READ_FAILED});
+        playback.remaining = 0;
+        if (playback.fill) {
+            freeCachedPcm(asset_cache.entries[playback.idx]);
+            playback.fill = nullptr;
+            playback.convert.copy_to = nullptr;
+        }
+        return 0;
+    }
+
+    if (playback.fill && !playback.convert.copy_to) {
+        memcpy((uint8_t*)playback.fill + playback.filled, buf, bytes_read);
+        playback.filled += bytes_read;
+    }
+    playback.remaining -= bytes_read;
+    playback.buf_idx = (playback.buf_idx + 1) % play_buffer_count;
+    return bytes_read;
+}
+
+// Queue more audio while the speaker has room, polled by audio_task
+bool updateResponseAudio() {
+    if (!playback.active) return false;
+
+    if (ambient.active) {
+        // Layered with the ambient loop, the mixer reads the clip
+        updateMixer();
+    } else if (playback.source && playback.remaining > 0) {
+        // A cached clip is already contiguous, so it goes to the speaker in one piece
+        M5Cardputer.Speaker.playRaw(playback.source, playback.remaining / sizeof(int16_t),
+                                    record_samplerate, false, 1, play_channel);
+        playback.remaining = 0;
+    } else {
+        // The speaker holds one playing and one queued buffer per channel,
+        // so the third buffer is always free to fill
+        while (playback.remaining > 0 && M5Cardputer.Speaker.isPlaying(play_channel) < 2) {
+            int16_t* buf;
+            size_t bytes_read = readResponseChunk(buf);
+            if (bytes_read == 0) break;
+            M5Cardputer.Speaker.playRaw(buf, bytes_read / sizeof(int16_t),
+                                        record_samplerate, false, 1, play_channel);
+        }
+    }
+
+    if (playback.remaining == 0 && playback.file) {
+        playback.file.close();
+    }
+    if (playback.remaining == 0 && playback.fill) {
+        // The last output sample can come before the end of the last block
+        CachedAsset& entry = asset_cache.entries[playback.idx];
+        if (playback.convert.copy_to && playback.convert.copied != entry.pcm_bytes) {
+            freeCachedPcm(entry);
+        } else {
+            entry.pcm_ready = true;
+        }
+        playback.fill = nullptr;
+        playback.convert.copy_to = nullptr;
+    }
+
+    // Finished once the last queued chunk has drained, or been mixed in
+    // while the ambient loop keeps the speaker busy
+    if (playback.remaining == 0 && (ambient.active || !M5Cardputer.Speaker.isPlaying(play_channel))) {
+        playback.active = false;
+        printf("Audio playback complete\n");
+        return false;
+    }
+    return true;
+}
+
+// Cancel response audio, dropping anything still queued
+void stopResponseAudio() {
+    if (!playback.active) return;
+
+    M5Cardputer.Speaker.stop(play_channel);
+    if (playback.file) {
+        playback.file.close();
+    }
+    if (playback.fill) {
+        // A partly copied clip is no use to the cache
+        freeCachedPcm(asset_cache.entries[playback.idx]);
+        playback.fill = nullptr;
+        playback.convert.copy_to = nullptr;
+    }
+    playback.remaining = 0;
+    playback.ready = 0;
+    playback.active = false;
+    printf("Audio playback stopped\n");
+}
+
+static inline int16_t saturateSample(int32_t sample) {
+    return std::max<int32_t>(-32768, std::min<int32_t>(32767, sample));
+}
+
+// Add n samples of in to out with saturation, scaled by a Q15 gain ramped
+// from one value to the other across the chunk. Plain loops over int32
+// lanes: the clamp compiles to the ESP32-S3's MIN/MAX instructions, so
+// there is no branch per sample.
+static void mixVoice(int16_t* out, const int16_t* in, size_t n, int32_t from, int32_t to) {
+    if (n == 0) return;
+    if (from == to) {
+        if (from == mix_unity) {
+            for (size_t i = 0; i < n; i++) out[i] = saturateSample(out[i] + in[i]);
+        } else {
+            for (size_t i = 0; i < n; i++) out[i] = saturateSample(out[i] + (in[i] * from >> 15));
+        }
+        return;
+    }
+    // 10 extra fraction bits so a chunk-long ramp still moves every sample
+    int32_t gain = from << 10;
+    int32_t step = ((to - from) << 10) / (int32_t)n;
+    for (size_t i = 0; i < n; i++, gain += step) {
+        out[i] = saturateSample(out[i] + (in[i] * (gain >> 10) >> 15));
+    }
+}
+
+static int32_t stepGain(int32_t gain, int32_t target) {
+    if (gain < target) return std::min(gain + mix_fade_step, target);
+    return std::max(gain - mix_fade_step, target);
+}
+
+// Check the loop can be played and allocate what mixing needs, ~10KB in all.
+// Without it every clip plays straight from the play buffers as before.
+bool loadAmbientLoop() {
+    if (!SD.exists(ambient_path)) return false;
+    if (!resolveWavAsset(ambient_path, ambient.asset) || ambient.asset.pcm_bytes == 0) return false;
+
+    ambient.convert.buffer = (uint8_t*)heap_caps_malloc(wav_raw_bytes, MALLOC_CAP_8BIT);
+    ambient.samples = (int16_t*)heap_caps_malloc(play_chunk_samples * sizeof(int16_t), MALLOC_CAP_8BIT);
+    bool ok = ambient.convert.buffer && ambient.samples;
+    for (size_t i = 0; i < play_buffer_count; i++) {
+        mix_buffers[i] = (int16_t*)heap_caps_malloc(play_chunk_samples * sizeof(int16_t), MALLOC_CAP_8BIT);
+        ok = ok && mix_buffers[i];
+    }
+    if (!ok) {
+        printf("Not enough memory for the ambient loop\n");
+        free(ambient.samples);
+        free(ambient.convert.buffer);
+        ambient.samples = nullptr;
+        ambient.convert.buffer = wav_raw;
+        for (size_t i = 0; i < play_buffer_count; i++) {
+            free(mix_buffers[i]);
+            mix_buffers[i] = nullptr;
+        }
+        return false;
+    }
+    ambient.loaded = true;
+    printf("Ambient loop: %s\n", ambient_path);
+    return true;
+}
+
+// Seek back to the loop's first sample
+static bool rewindAmbient() {
+    if (!ambient.file.seek(ambient.asset.pcm_offset)) return false;
+    ambient.remaining = startWavConverter(ambient.convert, ambient.asset);
+    return ambient.remaining > 0;
+}
+
+void startAmbient() {
+    if (!ambient.loaded) return;
+    if (!ambient.active) {
+        ambient.file = openAssetFile(ambient_path);
+        if (!ambient.file || !rewindAmbient()) {
+            if (ambient.file) ambient.file.close();
+            return;
+        }
+        ambient.gain = 0;
+        ambient.active = true;
+    }
+    ambient.target = ambient_gain;
+}
+
+void setAmbientTarget(int32_t gain) {
+    if (ambient.active) ambient.target = gain;
+}
+
+void stopAmbient() {
+    if (!ambient.active) return;
+    ambient.file.close();
+    ambient.active = false;
+}
+
+// Fill out with the next samples of the loop, wrapping at its end. Returns
+// fewer only if the file can't be read.
+static size_t readAmbient(int16_t* out, size_t samples) {
+    size_t produced = 0;
+    while (produced < samples) {
+        if (ambient.remaining == 0 && !rewindAmbient()) break;
+        size_t want = std::min(samples - produced, ambient.remaining / sizeof(int16_t));
+        size_t got;
+        if (ambient.convert.active) {
+            got = convertWavSamples(ambient.file, ambient.convert, out + produced, want);
+        } else {
+            got = readSD(ambient.file, out + produced, want * sizeof(int16_t)) / sizeof(int16_t);
+        }
+        produced += got;
+        ambient.remaining = got < want ? 0 : ambient.remaining - got * sizeof(int16_t);
+        if (got == 0) break;
+    }
+    return produced;
+}
+
+// Mix the answer clip (if one is playing) and the ambient loop a chunk at a
+// time, as long as the speaker has room. The loop stops once faded out.
+void updateMixer() {
+    while (M5Cardputer.Speaker.isPlaying(play_channel) < 2) {
+        bool answer = playback.active && playback.remaining > 0;
+        if (!answer && !ambient.active) break;
+
+        int16_t* out = mix_buffers[mix_idx];
+        memset(out, 0, play_chunk_samples * sizeof(int16_t));
+        size_t samples = ambient.active ? play_chunk_samples : 0;
+
+        if (answer) {
+            const int16_t* in = playback.source;
+            size_t n;
+            if (playback.source) {
+                n = std::min(playback.remaining, play_chunk_samples * sizeof(int16_t)) / sizeof(int16_t);
+                playback.source += n;
+                playback.remaining -= n * sizeof(int16_t);
+            } else {
+                int16_t* buf;
+                n = readResponseChunk(buf) / sizeof(int16_t);
+                in = buf;
+            }
+            mixVoice(out, in, n, answer_gain, answer_gain);
+            samples = std::max(samples, n);
+        }
+
+        if (ambient.active) {
+            size_t n = readAmbient(ambient.samples, play_chunk_samples);
+            int32_t next = stepGain(ambient.gain, ambient.target);
+            mixVoice(out, ambient.samples, n, ambient.gain, next);
+            ambient.gain = next;
+            if (ambient.gain == 0 && ambient.target == 0) {
+                stopAmbient();
+            }
+        }
+
+        if (samples == 0) break;
+        M5Cardputer.Speaker.playRaw(out, samples, record_samplerate, false, 1, play_channel);
+        mix_idx = (mix_idx + 1) % play_buffer_count;
+    }
+}
+
+// Ending one driver and starting the other reinstalls the I2S driver and
+// restarts the amp, which pops; doing it only when the owner changes keeps
+// both off the path between a key press and the sound
+void useAudioDevice(AudioDevice device) {
+    if (device == audio_device) return;
+
+    uint32_t start = micros();
+    if (audio_device == AUDIO_DEVICE_MIC) {
+        M5Cardputer.Mic.end();
+    } else if (audio_device == AUDIO_DEVICE_SPEAKER) {
+        M5Cardputer.Speaker.end();
+    }
+    if (device == AUDIO_DEVICE_MIC) {
+        M5Cardputer.Mic.begin();
+    } else if (device == AUDIO_DEVICE_SPEAKER) {
+        M5Cardputer.Speaker.begin();
+    }
+    audio_device = device;
+    printf("Audio device: %s (%u us)\n",
+           device == AUDIO_DEVICE_MIC ? "mic" : device == AUDIO_DEVICE_SPEAKER ? "speaker" : "off", micros() - start);
+}
+
+// Start audio_task on the core loop() doesn't use
+void startAudioTask() {
+    xTaskCreatePinnedToCore(audioTask, "audio", audio_task_stack, nullptr, audio_task_priority, &audio_task,
+                            audio_task_core);
+}
+
+// Serve commands, then keep the mic, speaker and prefetch going. Sleeps until
+// the next command when idle, and wakes every audio_service_ms while busy.
+void audioTask(void* arg) {
+    for (;;) {
+        AudioCommand cmd;
+        while (audio_commands.pop(cmd)) {
+            handleAudioCommand(cmd);
+        }
+
+        if (capture_active) {
+            serviceVoiceCapture();
+        }
+        if (playback.active) {
+            if (!updateResponseAudio()) {
+                setAmbientTarget(0);
+                postAudioEvent({AUDIO_PLAY_DONE, 0, 0});
+            }
+        } else if (ambient.active) {
+            updateMixer();
+        }
+
+        // The prefetch is SD bound, so it only waits a tick between reads
+        TickType_t wait = portMAX_DELAY;
+        if (stepPrefetch()) {
+            wait = 1;
+        } else if (capture_active || playback.active || ambient.active) {
+            wait = pdMS_TO_TICKS(audio_service_ms);
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+void handleAudioCommand(const AudioCommand& cmd) {
+    switch (cmd.type) {
+        case AUDIO_START_CAPTURE:
+            rec_record_idx = 0;
+            rec_analyze_idx = 0;
+            voice_features = AudioFeatures();
+            voice_activity = VoiceActivity();
+            rec_chunk_limit = (vad_enabled && vad_wait_for_onset) ? vad_onset_timeout + record_number : record_number;
+            memset(rec_data, 0, rec_ring_size * sizeof(int16_t));
+            stopAmbient();
+            useAudioDevice(AUDIO_DEVICE_MIC);
+            capture_active = true;
+            break;
+
+        case AUDIO_PREFETCH:
+            startPrefetch(cmd.idx);
+            // Warm the speaker while the animation runs
+            if (ambient.loaded || (cmd.idx < responses.size() && !responses[cmd.idx].wav_path.isEmpty())) {
+                useAudioDevice(AUDIO_DEVICE_SPEAKER);
+            }
+            startAmbient();
+            break;
+
+        case AUDIO_FINISH_PREFETCH:
+            finishPrefetch();
+            postAudioEvent({AUDIO_PREFETCH_DONE, 0, 0});
+            break;
+
+        case AUDIO_PLAY:
+            setAmbientTarget(ambient_duck_gain);
+            if (!playResponseAudio(cmd.idx)) {
+                setAmbientTarget(0);
+                postAudioEvent({AUDIO_PLAY_DONE, 0, 0});
+            }
+            break;
+
+        case AUDIO_STOP:
+            stopResponseAudio();
+            if (ambient.active) {
+                M5Cardputer.Speaker.stop(play_channel);
+                stopAmbient();
+            }
+            cancelPrefetch();
+            useAudioDevice(AUDIO_DEVICE_MIC);  // Ready for the next voice question
+            printAssetCacheStats();
+            break;
+
+        case AUDIO_POWER_DOWN:
+            useAudioDevice(AUDIO_DEVICE_NONE);
+            break;
+    }
+}
+
+// Keep the mic fed, ending the capture once VAD or the chunk limit says so
+void serviceVoiceCapture() {
+    queueVoiceChunks();
+    if (rec_analyze_idx >= rec_chunk_limit) {
+        // Recording complete, every chunk has been analysed. The mic stays
+        // up until AUDIO_PREFETCH wants the speaker.
+        capture_active = false;
+        postAudioEvent({AUDIO_CAPTURE_DONE, 0, generateSeedFromFeatures(voice_features)});
+        return;
+    }
+    if (rec_analyze_idx == 0) return;
+
+    size_t start = 0;
+    if (vad_enabled && vad_wait_for_onset) {
+        start = voice_activity.speech_started ? voice_activity.onset_chunk : rec_record_idx;
+    }
+    uint32_t progress = ((rec_record_idx - start) * 100) / record_number;
+    // The UI only needs the latest progress, so a full queue just skips one
+    postAudioEvent({AUDIO_CAPTURE_PROGRESS, (uint16_t)(rec_analyze_idx - 1), progress}, true);
+}
+
+// Post an event to loop(), waiting for room unless it can be dropped
+void postAudioEvent(const AudioEvent& event, bool may_drop) {
+    while (!audio_events.push(event) && !may_drop) {
+        vTaskDelay(1);
+    }
+}
+
+// Queue a command for audio_task and wake it
+void sendAudioCommand(AudioCommandType type, uint16_t idx) {
+    while (!audio_commands.push({type, idx})) {
+        vTaskDelay(1);
+    }
+    xTaskNotifyGive(audio_task);
+}
+
+// Fold the audio task's events into the UI state. Playback messages are
+// drawn over the answer screen as they arrive.
+void handleAudioEvents() {
+    AudioEvent event;
+    while (audio_events.pop(event)) {
+        switch (event.type) {
+            case AUDIO_CAPTURE_PROGRESS:
+                voice_progress = event.value;
+                draw_record_idx = event.chunk;
+                break;
+
+            case AUDIO_CAPTURE_DONE:
+                voice_seed = event.value;
+                voice_capture_done = true;
+                break;
+
+            case AUDIO_PREFETCH_DONE:
+                break;
+
+            case AUDIO_PLAY_STARTED:
+                if (current_state != SHOWING_ANSWER) break;
+                waitFramePush();
+                frame.setTextColor(CYAN);
+                frame.drawString("Playing audio...", 5, 90);
+                pushFrame();
+                break;
+
+            case AUDIO_PLAY_FAILED:
+                if (current_state != SHOWING_ANSWER) break;
+                waitFramePush();
+                frame.setTextColor(RED);
+                if (event.value == AUDIO_FILE_NOT_FOUND) {
+                    frame.drawString("Audio file not found!", 5, 90);
+                    frame.drawString(responses[current_response_idx].wav_path.c_str(), 5, 105);
+                } else {
+                    frame.drawString("Failed to read audio", 5, 90);
+                }
+                pushFrame();
+                break;
+
+            case AUDIO_PLAY_DONE:
+                audio_busy = false;
+                break;
+        }
+    }
+}
+
+// Wait for the task to answer a command, dropping anything queued before it
+void waitForAudioEvent(AudioEventType type) {
+    for (;;) {
+        AudioEvent event;
+        while (audio_events.pop(event)) {
+            if (event.type == type) return;
+        }
+        vTaskDelay(1);
+    }
+}
+
+// Begin pre-reading a response's assets. Nothing is playing during THINKING,
+// so the WAV's first chunks go straight into the playback buffers.
+void startPrefetch(uint16_t idx) {
+    cancelPrefetch();
+    prefetch.idx = idx;
+    prefetch.step = idx < responses.size() ? PREFETCH_WAV_OPEN : PREFETCH_DONE;
+}
+
+// Cached assets are skipped by the prefetch
+static bool cachedPcmReady(uint16_t idx) {
+    return idx < asset_cache.entries.size() && asset_cache.entries[idx].pcm_ready;
+}
+
+static bool cachedPixelsReady(uint16_t idx) {
+    return idx < asset_cache.entries.size() && asset_cache.entries[idx].pixels_ready;
+}
+
+// Advance the prefetch by one open or one chunk-sized read
+bool stepPrefetch() {
+    if (prefetch.step == PREFETCH_DONE) return false;
+
+    const Response& r = responses[prefetch.idx];
+    switch (prefetch.step) {
+        case PREFETCH_WAV_OPEN: {
+            prefetch.step = PREFETCH_BMP_OPEN;
+            if (r.wav_path.isEmpty() || cachedPcmReady(prefetch.idx)) break;
+
+            // Failures are left for playResponseAudio to report on screen
+            File file;
+            size_t bytes = 0;
+            if (!openResponseAudio(prefetch.idx, file, bytes, prefetch.wav_convert)) break;
+            prefetch.wav_file = file;
+            prefetch.wav_remaining = bytes;
+            prefetch.wav_ready = 0;
+            prefetch.step = PREFETCH_WAV_CHUNKS;
+            break;
+        }
+
+        case PREFETCH_WAV_CHUNKS: {
+            size_t chunk_bytes = play_chunk_samples * sizeof(int16_t);
+            size_t offset = prefetch.wav_ready * chunk_bytes;
+            if (prefetch.wav_ready >= play_buffer_count || offset >= prefetch.wav_remaining) {
+                prefetch.step = PREFETCH_BMP_OPEN;
+                break;
+            }
+            size_t chunk_size = std::min(prefetch.wav_remaining - offset, chunk_bytes);
+            int16_t* buf = play_buffers[prefetch.wav_ready];
+            size_t bytes_read;
+            {
+                ProfileScope timer(PROF_WAV_READ);
+                bytes_read = prefetch.wav_convert.active
+                    ? convertWavSamples(prefetch.wav_file, prefetch.wav_convert, buf,
+                                        chunk_size / sizeof(int16_t)) * sizeof(int16_t)
+                    : readSD(prefetch.wav_file, buf, chunk_size);
+            }
+            if (bytes_read != chunk_size) {
+                // Let playback reopen and report the read error
+                dropWavCopy(prefetch.idx, prefetch.wav_convert);
+                prefetch.wav_file.close();
+                prefetch.wav_ready = 0;
+                prefetch.step = PREFETCH_BMP_OPEN;
+                break;
+            }
+            prefetch.wav_ready++;
+            break;
+        }
+
+        case PREFETCH_BMP_OPEN:
+            prefetch.bmp_rows = 0;
+            prefetch.step = PREFETCH_DONE;
+            if (!r.bitmap_path.isEmpty() && !cachedPixelsReady(prefetch.idx) &&
+                openResponseBitmap(prefetch.idx, prefetch.bmp_file, prefetch.bmp)) {
+                prefetch.step = PREFETCH_BMP_ROWS;
+            }
+            break;
+
+        case PREFETCH_BMP_ROWS: {
+            const BmpInfo& info = prefetch.bmp;
+            size_t max_rows = std::min<size_t>(bmp_prefetch_bytes / info.row_stride, info.height);
+            size_t rows = std::min(bmp_chunk_bytes / info.row_stride, max_rows - prefetch.bmp_rows);
+            if (rows == 0) {
+                prefetch.step = PREFETCH_DONE;
+                break;
+            }
+            size_t bytes = rows * info.row_stride;
+            if (readSD(prefetch.bmp_file, bmp_prefetch + prefetch.bmp_rows * info.row_stride, bytes) != bytes) {
+                printf("Failed to read bitmap rows\n");
+                prefetch.bmp_file.close();
+                prefetch.step = PREFETCH_DONE;
+                break;
+            }
+            prefetch.bmp_rows += rows;
+            break;
+        }
+
+        case PREFETCH_DONE:
+            break;
+    }
+    return prefetch.step != PREFETCH_DONE;
+}
+
+// Run whatever the animation didn't leave time for
+void finishPrefetch() {
+    while (stepPrefetch()) {
+    }
+}
+
+// Close whatever the answer screen didn't take over
+void cancelPrefetch() {
+    if (prefetch.wav_file) {
+        dropWavCopy(prefetch.idx, prefetch.wav_convert);
+        prefetch.wav_file.close();
+    }
+    if (prefetch.bmp_file) prefetch.bmp_file.close();
+    prefetch.wav_ready = 0;
+    prefetch.bmp_rows = 0;
+    prefetch.step = PREFETCH_DONE;
+}
+
+// One slot per response, in PSRAM if present
+void initAssetCache() {
+    for (CachedAsset& entry : asset_cache.entries) {
+        freeCachedPcm(entry);
+        freeCachedPixels(entry);
+    }
+    asset_cache.entries.assign(responses.size(), CachedAsset());
+    if (psramFound()) {
+        asset_cache.budget = asset_cache_psram_budget;
+        asset_cache.caps = MALLOC_CAP_SPIRAM;
+    } else {
+        asset_cache.budget = asset_cache_internal_budget;
+        asset_cache.caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    }
+    printf("Asset cache: %d bytes in %s\r\n", asset_cache.budget, psramFound() ? "PSRAM" : "internal RAM");
+}
+
+CachedAsset* findCachedAsset(uint16_t idx) {
+    if (idx >= asset_cache.entries.size()) return nullptr;
+    CachedAsset& entry = asset_cache.entries[idx];
+    entry.last_used = ++asset_cache.clock;
+    return &entry;
+}
+
+// Allocate cache memory for response idx, evicting the least recently used
+// other responses until it fits. Returns nullptr if it never can.
+void* allocCachedBytes(uint16_t idx, size_t bytes) {
+    if (bytes == 0 || bytes > asset_cache.budget) return nullptr;
+
+    while (asset_cache.used + bytes > asset_cache.budget) {
+        CachedAsset* oldest = nullptr;
+        for (size_t i = 0; i < asset_cache.entries.size(); i++) {
+            CachedAsset& entry = asset_cache.entries[i];
+            if (i == idx || (!entry.pcm && !entry.pixels)) continue;
+            if (!oldest || entry.last_used < oldest->last_used) oldest = &entry;
+        }
+        if (!oldest) return nullptr;
+        freeCachedPcm(*oldest);
+        freeCachedPixels(*oldest);
+    }
+
+    void* data = heap_caps_malloc(bytes, asset_cache.caps);
+    if (data) asset_cache.used += bytes;
+    return data;
+}
+
+void freeCachedPcm(CachedAsset& entry) {
+    if (!entry.pcm) return;
+    heap_caps_free(entry.pcm);
+    asset_cache.used -= entry.pcm_bytes;
+    entry.pcm = nullptr;
+    entry.pcm_bytes = 0;
+    entry.pcm_ready = false;
+}
+
+void freeCachedPixels(CachedAsset& entry) {
+    if (!entry.pixels) return;
+    heap_caps_free(entry.pixels);
+    asset_cache.used -= entry.pixel_bytes;
+    entry.pixels = nullptr;
+    entry.pixel_bytes = 0;
+    entry.pixels_ready = false;
+}
+
+void printAssetCacheStats() {
+    printf("Asset cache: %u hits, %u misses, %d/%d bytes used\n",
+           asset_cache.hits, asset_cache.misses, asset_cache.used, asset_cache.budget);
+}
+
+// The calling task's row. The tasks are pinned, so a scope's two cycle
+// counts always come from the same core.
+static ProfileRow profileRow() {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    if (task == catalog_task) return PROF_ROW_CATALOG;
+    if (task == audio_task) return PROF_ROW_AUDIO;
+    return PROF_ROW_LOOP;
+}
+
+// Fold one timed scope into the calling task's row
+void recordProfile(ProfilePoint point, uint32_t cycles, size_t bytes) {
+    ProfileStat& stat = profile_stats[profileRow()][point];
+    stat.count++;
+    stat.min_cycles = std::min(stat.min_cycles, cycles);
+    stat.max_cycles = std::max(stat.max_cycles, cycles);
+    stat.total_cycles += cycles;
+    stat.bytes += bytes;
+    uint32_t us = cycles / profile_cycles_per_us;
+    int bits = 32 - __builtin_clz(us | 1);
+    stat.histogram[std::min<size_t>((bits - 1) / 2, profile_buckets - 1)]++;
+}
+
+ProfileStat profileTotals(ProfilePoint point) {
+    ProfileStat total;
+    for (size_t row = 0; row < PROF_ROW_COUNT; row++) {
+        const ProfileStat& stat = profile_stats[row][point];
+        total.count += stat.count;
+        total.min_cycles = std::min(total.min_cycles, stat.min_cycles);
+        total.max_cycles = std::max(total.max_cycles, stat.max_cycles);
+        total.total_cycles += stat.total_cycles;
+        total.bytes += stat.bytes;
+        for (size_t b = 0; b < profile_buckets; b++) {
+            total.histogram[b] += stat.histogram[b];
+        }
+    }
+    return total;
+}
+
+size_t readSD(File& file, void* buffer, size_t bytes) {
+    ProfileScope timer(PROF_SD_READ);
+    timer.bytes = file.read((uint8_t*)buffer, bytes);
+    return timer.bytes;
+}
+
+static uint32_t profileAverageUs(const ProfileStat& stat) {
+    return stat.count ? stat.total_cycles / stat.count / profile_cycles_per_us : 0;
+}
+
+// Read throughput while the card was actually being read
+static uint32_t sdReadKBps() {
+    ProfileStat reads = profileTotals(PROF_SD_READ);
+    uint64_t us = reads.total_cycles / profile_cycles_per_us;
+    return us ? reads.bytes * 1000000 / us / 1024 : 0;
+}
+
+// "850us" or "12.3ms", to keep overlay lines short
+static void formatProfileTime(char* out, size_t size, uint32_t us) {
+    if (us < 1000) {
+        snprintf(out, size, "%uus", us);
+    } else {
+        snprintf(out, size, "%u.%ums", us / 1000, us % 1000 / 100);
+    }
+}
+
+void toggleProfileOverlay() {
+    if (overlay.visible) {
+        overlay.visible = false;
+        pushRegion(0, frame.height() - overlay_height, frame.width(), overlay_height);
+        heap_caps_free(overlay.under);
+        overlay.under = nullptr;
+        return;
+    }
+    overlay.under = (uint8_t*)heap_caps_malloc(overlayBandBytes(), MALLOC_CAP_8BIT);
+    if (!overlay.under) {
+        printf("Not enough memory for the profiling overlay\n");
+        return;
+    }
+    overlay.visible = true;
+    overlay.refreshed = millis();
+    overlay.refreshed_pushes = profileTotals(PROF_FRAME_PUSH).count;
+    refreshProfileOverlay();
+}
+
+// FPS counts the pushes since the last refresh; the times are averages
+// since boot
+void refreshProfileOverlay() {
+    unsigned long now = millis();
+    uint32_t pushes = profileTotals(PROF_FRAME_PUSH).count;
+    unsigned long elapsed = std::max(1ul, now - overlay.refreshed);
+    uint32_t fps = (pushes - overlay.refreshed_pushes) * 1000 / elapsed;
+    overlay.refreshed = now;
+    overlay.refreshed_pushes = pushes;
+
+    char psram[12] = "-";
+    if (psramFound()) snprintf(psram, sizeof(psram), "%uK", ESP.getFreePsram() / 1024);
+    snprintf(overlay.lines[0], sizeof(overlay.lines[0]), "FPS %u  heap %uK  blk %uK  psram %s", fps,
+             ESP.getFreeHeap() / 1024, ESP.getMaxAllocHeap() / 1024, psram);
+
+    char open[12], answer[12], wav[12], mic[12], push[12];
+    formatProfileTime(open, sizeof(open), profileAverageUs(profileTotals(PROF_SD_OPEN)));
+    formatProfileTime(answer, sizeof(answer), profileAverageUs(profileTotals(PROF_DISPLAY_ANSWER)));
+    formatProfileTime(wav, sizeof(wav), profileAverageUs(profileTotals(PROF_WAV_READ)));
+    formatProfileTime(mic, sizeof(mic), profileAverageUs(profileTotals(PROF_MIC_RECORD)));
+    formatProfileTime(push, sizeof(push), profileAverageUs(profileTotals(PROF_FRAME_PUSH)));
+    snprintf(overlay.lines[1], sizeof(overlay.lines[1]), "SD %uKB/s  open %s  ans %s", sdReadKBps(), open, answer);
+    snprintf(overlay.lines[2], sizeof(overlay.lines[2]), "wav %s  mic %s  push %s", wav, mic, push);
+
+    ProfileStat wakes = profileTotals(PROF_WAKE);
+    char wake[12] = "-";
+    if (wakes.count) formatProfileTime(wake, sizeof(wake), profileAverageUs(wakes));
+    snprintf(overlay.lines[3], sizeof(overlay.lines[3]), "wake %s  boot %ums  catalog %ums", wake,
+             boot_interactive_ms, boot_catalog_ms);
+
+    pushRegion(0, frame.height() - overlay_height, frame.width(), overlay_height);
+}
+
+// One "sys" record, then one per timed point with its histogram
+void dumpProfile() {
+    printf("prof sys uptime_ms=%lu boot_ms=%u catalog_ms=%u heap=%u largest=%u psram=%u sd_kbps=%u sd_clock=%u\n",
+           millis(), boot_interactive_ms, boot_catalog_ms, ESP.getFreeHeap(), ESP.getMaxAllocHeap(),
+           psramFound() ? ESP.getFreePsram() : 0, sdReadKBps(), sd_clock_hz);
+    for (size_t p = 0; p < PROF_COUNT; p++) {
+        ProfileStat stat = profileTotals((ProfilePoint)p);
+        printf("prof %s n=%u min=%u avg=%u max=%u us bytes=%llu hist=", profile_names[p], stat.count,
+               stat.count ? stat.min_cycles / profile_cycles_per_us : 0, profileAverageUs(stat),
+               stat.max_cycles / profile_cycles_per_us, stat.bytes);
+        for (size_t b = 0; b < profile_buckets; b++) {
+            printf(b ? ",%u" : "%u", stat.histogram[b]);
+        }
+        printf("\n");
+    }
+}
+
+// Check the mounted card reads sector 0 back the same way every time, with
+// the 0x55AA signature every MBR and FAT boot sector ends in
+static bool sdReadsStable(uint8_t* first, uint8_t* again) {
+    if (!SD.readRAW(first, 0) || first[510] != 0x55 || first[511] != 0xAA) return false;
+    for (int i = 1; i < sd_probe_reads; i++) {
+        if (!SD.readRAW(again, 0) || memcmp(first, again, 512) != 0) return false;
+    }
+    return true;
+}
+
+bool beginSD() {
+    uint8_t* sector = (uint8_t*)malloc(1024);
+    if (sector) {
+        for (uint32_t hz : sd_probe_clocks) {
+            if (!SD.begin(SD_SPI_CS_PIN, SPI, hz)) continue;
+            if (sdReadsStable(sector, sector + 512)) {
+                sd_clock_hz = hz;
+                break;
+            }
+            SD.end();
+        }
+        free(sector);
+    }
+    if (sd_clock_hz == 0) {
+        if (!SD.begin(SD_SPI_CS_PIN, SPI, sd_fallback_clock)) return false;
+        sd_clock_hz = sd_fallback_clock;
+    }
+    printf("SD clock: %u kHz\n", sd_clock_hz / 1000);
+    return true;
+}
+
+void setup(void)
+{
+    auto cfg = M5.config();
+
+    M5Cardputer.begin(cfg);
     Serial.begin(115200);
     M5Cardputer.Display.startWrite();
     M5Cardputer.Display.setRotation(1);
-    M5Cardputer.Display.setTextDatum(top_center);
-    M5Cardputer.Display.setTextColor(WHITE);
-    M5Cardputer.Display.setFont(&fonts::FreeSansBoldOblique12pt7b);
 
+    // Full-screen frame buffer (~64KB at 16bpp), falls back to 8bpp if the
+    // heap can't fit it
+    frame.setColorDepth(16);
+    if (!frame.createSprite(M5Cardputer.Display.width(), M5Cardputer.Display.height())) {
+        frame_dma = false;
+        frame.setColorDepth(8);
+        if (!frame.createSprite(M5Cardputer.Display.width(), M5Cardputer.Display.height())) {
+            printf("Failed to allocate frame buffer\r\n");
+            while (1);
+        }
+    }
+    frame.setTextDatum(top_center);
+    frame.setTextColor(WHITE);
+    frame.setFont(&fonts::FreeSansBoldOblique12pt7b);
+
+    // Waveform meter only needs a couple of colours, 8bpp keeps it ~19KB
+    wave_sprite.setColorDepth(8);
+    if (!wave_sprite.createSprite(M5Cardputer.Display.width(), wave_height)) {
+        printf("Failed to allocate waveform sprite\r\n");
+    }
+
+    rec_data = (typeof(rec_data))heap_caps_malloc(rec_ring_size * sizeof(int16_t), MALLOC_CAP_8BIT);
+    memset(rec_data, 0, rec_ring_size * sizeof(int16_t));
+    for (size_t i = 0; i < play_buffer_count; i++) {
+        play_buffers[i] = (int16_t*)heap_caps_malloc(play_chunk_samples * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    profile_cycles_per_us = ESP.getCpuFreqMHz();
+
+    // Show idle screen, then load the card behind it
+    displayIdle();
+    startInputTask();
+    startCatalogTask();
+
+    // Volume survives the driver switches, so it is only set once
+    M5Cardputer.Speaker.setVolume(255);
+    M5Cardputer.Speaker.end();
+    useAudioDevice(AUDIO_DEVICE_MIC);
+    startAudioTask();
+
+    waitFramePush();
+    boot_interactive_ms = millis();
+    printf("Magic Eight Ball interactive after %u ms\r\n", boot_interactive_ms);
+}
+
+void startCatalogTask() {
+    xTaskCreatePinnedToCore(catalogTask, "catalog", catalog_task_stack, nullptr, catalog_task_priority,
+                            &catalog_task, audio_task_core);
+}
+
+// Load the catalog, publish the result through catalog_status, then print
+// what setup() used to print before the idle screen could appear
+void catalogTask(void* arg) {
+    bool loaded = loadCatalog();
+    boot_catalog_ms = millis();
+    catalog_status = loaded ? CATALOG_READY : CATALOG_FAILED;
+    if (!loaded) {
+        printf("ERROR: %s\r\n", catalog_error);
+        vTaskDelete(nullptr);
+        return;
+    }
+
+    printf("Catalog ready after %u ms: %d responses\r\n", boot_catalog_ms, responses.size());
+    printCardDiagnostics();
+    // Print loaded responses for debugging
+    for (size_t i = 0; i < responses.size() && i < 5; i++) {
+        printf("  Response %d: %s", i, responses[i].text.c_str());
+        if (!responses[i].wav_path.isEmpty()) {
+            printf(" [wav: %s]", responses[i].wav_path.c_str());
+        }
+        if (!responses[i].bitmap_path.isEmpty()) {
+            printf(" [bmp: %s]", responses[i].bitmap_path.c_str());
+        }
+        printf("\r\n");
+    }
+    if (responses.size() > 5) {
+        printf("  ... and %d more responses\r\n", responses.size() - 5);
+    }
+    vTaskDelete(nullptr);
+}
+
+bool loadCatalog() {
     // SD Card Initialization
     SPI.begin(SD_SPI_SCK_PIN, SD_SPI_MISO_PIN, SD_SPI_MOSI_PIN, SD_SPI_CS_PIN);
+    if (!beginSD()) {
+        catalog_error = "Card failed, or not present";
+        return false;
+    }
+    if (SD.cardType() == CARD_NONE) {
+        catalog_error = "No SD card attached";
+        return false;
+    }
 
-    if (!SD.begin(SD_SPI_CS_PIN, SPI, 25000000)) {
-        printf("Card failed, or not present\r\n");
-        while (1);
+    // Load Magic Eight Ball responses, preferring the packed bundle, then the
+    // index compiled from an unchanged JSON config, then the JSON itself
+    if (!loadResponsesFromPack() && !loadResponsesFromIndex() && !loadResponsesFromSD()) {
+        printf("Generating default responses.json...\r\n");
+        if (!generateDefaultConfig()) {
+            catalog_error = "Failed to generate default config";
+            return false;
+        }
+        if (!loadResponsesFromSD()) {
+            catalog_error = "Failed to load responses even after generating default";
+            return false;
+        }
     }
+
+    buildAliasTable();
+    initAssetCache();
+    loadAmbientLoop();
+    return true;
+}
+
+void printCardDiagnostics() {
     uint8_t cardType = SD.cardType();
-    if (cardType == CARD_NONE) {
-        printf("No SD card attached\r\n");
-        return;
-    }
     printf("SD Card Type: ");
     if (cardType == CARD_MMC) {
         printf("MMC\r\n");
@@ -590,200 +3630,364 @@ void setup(void)
     }
     uint64_t cardSize = SD.cardSize() / (1024 * 1024);
     printf("SD Card Size: %lluMB\r\n", cardSize);
+}
 
-    // Load Magic Eight Ball responses from JSON config
-    if (!loadResponsesFromSD()) {
-        printf("Generating default responses.json...\r\n");
-        if (generateDefaultConfig()) {
-            // Try loading again
-            if (!loadResponsesFromSD()) {
-                printf("ERROR: Failed to load responses even after generating default\r\n");
-                while (1);  // Halt if we can't load responses
+// Scan the keyboard and BtnA on a fixed cadence and queue what changed.
+// Keys pressed together in one scan become one event each.
+void inputTask(void* arg) {
+    TickType_t last_wake = xTaskGetTickCount();
+    for (;;) {
+        M5Cardputer.update();
+        uint32_t now = micros();
+
+        if (M5Cardputer.Keyboard.isChange() && M5Cardputer.Keyboard.isPressed()) {
+            Keyboard_Class::KeysState status = M5Cardputer.Keyboard.keysState();
+            if (status.del) {
+                postInputEvent({INPUT_DELETE, 0, now});
+            } else if (status.enter) {
+                postInputEvent({INPUT_ENTER, 0, now});
+            } else if (status.ctrl) {
+                // Ctrl combos are commands, never typed
+                for (auto key : status.word) {
+                    if (key == 'p') postInputEvent({INPUT_OVERLAY, 0, now});
+                    if (key == 'd') postInputEvent({INPUT_DUMP, 0, now});
+                }
+            } else {
+                for (auto key : status.word) {
+                    if (key >= 0x20 && key <= 0x7E) { // Printable ASCII
+                        postInputEvent({INPUT_CHAR, (char)key, now});
+                    }
+                }
             }
+        }
+        if (M5Cardputer.BtnA.wasPressed()) {
+            postInputEvent({INPUT_BUTTON, 0, now});
+        }
+
+        if (power_mode == POWER_SLEEP) {
+            sleepUntilNextScan();
+            last_wake = xTaskGetTickCount();
         } else {
-            printf("ERROR: Failed to generate default config\r\n");
-            while (1);  // Halt if we can't generate config
+            vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(input_scan_ms));
         }
     }
+}
 
-    // Print loaded responses for debugging
-    for (size_t i = 0; i < responses.size() && i < 5; i++) {
-        printf("  Response %d: %s", i, responses[i].text.c_str());
-        if (!responses[i].wav_path.isEmpty()) {
-            printf(" [wav: %s]", responses[i].wav_path.c_str());
-        }
-        if (!responses[i].bitmap_path.isEmpty()) {
-            printf(" [bmp: %s]", responses[i].bitmap_path.c_str());
-        }
-        printf("\r\n");
+void startInputTask() {
+    loop_task = xTaskGetCurrentTaskHandle();  // setup() and loop() share a task
+    xTaskCreatePinnedToCore(inputTask, "input", input_task_stack, nullptr, input_task_priority, nullptr,
+                            xPortGetCoreID());
+}
+
+// Queue an event and wake loop(). 64 slots is far more than anyone types
+// during one frame, so a full queue means loop() is stuck.
+void postInputEvent(const InputEvent& event) {
+    power_mode = POWER_ACTIVE;  // Stop sleeping between scans straight away
+    if (!input_events.push(event)) {
+        printf("Input queue full, event dropped\n");
+        return;
     }
-    if (responses.size() > 5) {
-        printf("  ... and %d more responses\r\n", responses.size() - 5);
+    xTaskNotifyGive(loop_task);
+}
+
+// Apply one input event to the state machine. Keys outside IDLE and
+// TEXT_INPUT are ignored, as is BtnA while recording or thinking; the
+// profiling combos work everywhere.
+void handleInputEvent(const InputEvent& event) {
+    if (event.type == INPUT_OVERLAY) {
+        toggleProfileOverlay();
+        return;
+    }
+    if (event.type == INPUT_DUMP) {
+        dumpProfile();
+        return;
     }
+    switch (current_state) {
+        case IDLE:
+            if (event.type == INPUT_CHAR) {
+                current_question = "";
+                current_question += event.key;
+                current_state = TEXT_INPUT;
+                question_dirty = false;
+                key_latency.pending = true;
+                key_latency.pending_us = event.time_us;
+                displayTextInput(current_question);
+                noteKeyShown();
+            } else if (event.type == INPUT_BUTTON) {
+                startVoiceInput();
+            }
+            break;
 
-    rec_data = (typeof(rec_data))heap_caps_malloc(record_size * sizeof(int16_t), MALLOC_CAP_8BIT);
-    memset(rec_data, 0, record_size * sizeof(int16_t));
-    M5Cardputer.Speaker.setVolume(255);
-    M5Cardputer.Speaker.end();
-    M5Cardputer.Mic.begin();
+        case TEXT_INPUT:
+            if (event.type == INPUT_ENTER || event.type == INPUT_BUTTON) {
+                submitTextQuestion();
+                break;
+            }
+            if (event.type == INPUT_DELETE && current_question.length() > 0) {
+                current_question.remove(current_question.length() - 1);
+            } else if (event.type == INPUT_CHAR) {
+                current_question += event.key;
+            } else {
+                break;
+            }
+            question_dirty = true;
+            if (!key_latency.pending) {
+                key_latency.pending = true;
+                key_latency.pending_us = event.time_us;
+            }
+            break;
+
+        case SHOWING_ANSWER:
+            if (event.type == INPUT_BUTTON) {
+                returnToIdle();  // Also skips the clip
+            }
+            break;
+
+        case VOICE_INPUT:
+        case THINKING:
+            break;
+    }
+}
+
+// Record the latency of the oldest keystroke the last push showed, once
+// its DMA transfer has actually reached the panel
+void noteKeyShown() {
+    if (!key_latency.pending) return;
+    waitFramePush();
+    uint32_t latency = micros() - key_latency.pending_us;
+    key_latency.pending = false;
+    key_latency.count++;
+    key_latency.total_us += latency;
+    key_latency.max_us = std::max(key_latency.max_us, latency);
+}
+
+void printInputLatency() {
+    if (key_latency.count > 0) {
+        printf("Key-to-pixel latency: %u repaints, avg %u us, max %u us\n", key_latency.count,
+               (uint32_t)(key_latency.total_us / key_latency.count), key_latency.max_us);
+    }
+    key_latency = InputLatency();
+}
+
+// Single press of BtnA from IDLE: record a voice question
+void startVoiceInput() {
+    current_state = VOICE_INPUT;
+    draw_record_idx = 0;
+    voice_progress = 0;
+    voice_capture_done = false;
+    sendAudioCommand(AUDIO_START_CAPTURE);
+    state_timer = millis();
+    displayVoiceInput(0);
+}
+
+// Enter or BtnA with a typed question: pick the answer and start thinking
+void submitTextQuestion() {
+    if (current_question.length() == 0) return;
+    printInputLatency();
+    beginThinking(generateSeedFromText(current_question));
+}
+
+// Start THINKING on a question's seed. Straight after boot the catalog may
+// still be loading; the animation then runs until it is and the answer is
+// picked from the same seed, so only this step ever waits for it.
+void beginThinking(uint32_t seed) {
+    thinking_seed = seed;
+    answer_chosen = false;
+    current_state = THINKING;
+    state_timer = millis();
+    if (catalog_status == CATALOG_READY) {
+        chooseAnswer();
+    }
+    displayThinking();
+}
 
-    // Show idle screen
+void chooseAnswer() {
+    current_response_idx = selectResponse(thinking_seed);
+    answer_chosen = true;
+    sendAudioCommand(AUDIO_PREFETCH, current_response_idx);
+}
+
+// Leave the answer, stopping its clip
+void returnToIdle() {
+    sendAudioCommand(AUDIO_STOP);
+    audio_busy = false;
+    current_state = IDLE;
+    current_question = "";
+    last_input_time = millis();  // The power timeouts count from here
     displayIdle();
-    printf("Magic Eight Ball initialized\r\n");
+}
+
+// Called from IDLE each poll. Modes only step down from here. A wake that
+// input_task posts while this steps to POWER_DIM stores the same
+// POWER_ACTIVE being replaced, so nothing here can see it; its event is
+// still queued, and noteInputActivity() raises the mode again when loop()
+// drains it. The step to POWER_SLEEP is a compare-exchange because a wake
+// since the check leaves POWER_ACTIVE, which must not be overwritten or
+// input_task would sleep through scans before loop() gets to the event.
+void updateIdlePower() {
+    unsigned long idle = millis() - last_input_time;
+    PowerMode mode = power_mode;
+    if (mode == POWER_ACTIVE && idle >= idle_dim_ms) {
+        active_brightness = M5Cardputer.Display.getBrightness();
+        M5Cardputer.Display.setBrightness(idle_dim_brightness);
+        backlight_lowered = true;
+        sendAudioCommand(AUDIO_POWER_DOWN);
+        power_mode = POWER_DIM;
+    } else if (mode == POWER_DIM && idle >= idle_sleep_ms && catalog_status != CATALOG_LOADING &&
+               !overlay.visible) {
+        // The whole chip stops, so no push may be in flight
+        waitFramePush();
+        M5Cardputer.Display.setBrightness(0);
+        power_mode.compare_exchange_strong(mode, POWER_SLEEP);
+    }
+}
+
+// Any input leaves low power. input_task already raised power_mode when it
+// posted the event, but a wake that raced the step to POWER_DIM was lost,
+// so it is raised again here. The I2S driver comes back on its next use:
+// AUDIO_START_CAPTURE brings up the mic, AUDIO_PREFETCH the speaker.
+void noteInputActivity(const InputEvent& event) {
+    last_input_time = millis();
+    if (!backlight_lowered) return;
+    power_mode = POWER_ACTIVE;
+    M5Cardputer.Display.setBrightness(active_brightness);
+    backlight_lowered = false;
+    wake_pending = true;
+    wake_time_us = event.time_us;
+}
+
+// A wake is timed from the scan that saw the input to the end of the push
+// showing TEXT_INPUT or VOICE_INPUT. A key can add up to sleep_scan_ms
+// before that scan; BtnA wakes the chip itself.
+void finishWake() {
+    wake_pending = false;
+    if (current_state == IDLE) return;  // Nothing interactive came of it
+    waitFramePush();
+    uint32_t latency = micros() - wake_time_us;
+    recordProfile(PROF_WAKE, latency * profile_cycles_per_us);
+    printf("Wake to interactive: %u us\n", latency);
+}
+
+// One scan interval of light sleep. BtnA is reported as soon as it wakes
+// the chip rather than after M5's debounce has seen a few more scans; the
+// extra press that reports later is ignored by VOICE_INPUT.
+void sleepUntilNextScan() {
+    esp_sleep_enable_timer_wakeup(sleep_scan_ms * 1000);
+    gpio_wakeup_enable(btn_a_gpio, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    esp_light_sleep_start();
+    uint32_t now = micros();
+    gpio_wakeup_disable(btn_a_gpio);
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) {
+        postInputEvent({INPUT_BUTTON, 0, now});
+    }
 }
 
 void loop(void)
 {
-    M5Cardputer.update();
+    // Nothing can be answered without the catalog, so stop here as setup()
+    // used to, but with the reason on screen
+    if (catalog_status == CATALOG_FAILED) {
+        displayCatalogError();
+        for (;;) vTaskDelay(portMAX_DELAY);
+    }
+
+    handleAudioEvents();
+    InputEvent event;
+    while (input_events.pop(event)) {
+        noteInputActivity(event);
+        handleInputEvent(event);
+    }
+    if (wake_pending) {
+        finishWake();
+    }
+    while (Serial.available() > 0) {
+        if (Serial.read() == 'p') dumpProfile();
+    }
+    if (overlay.visible && millis() - overlay.refreshed >= overlay_refresh_ms) {
+        refreshProfileOverlay();
+    }
 
     // Handle cursor blinking for text input
     if (millis() - last_cursor_blink > 500) {
         cursor_visible = !cursor_visible;
         last_cursor_blink = millis();
-        if (current_state == TEXT_INPUT) {
-            displayTextInput(current_question);
+        // A pending edit repaint draws the cursor itself
+        if (current_state == TEXT_INPUT && !question_dirty) {
+            blinkTextInputCursor();
         }
     }
 
     switch (current_state) {
-        case IDLE: {
-            // Check for keyboard input
-            if (M5Cardputer.Keyboard.isChange()) {
-                if (M5Cardputer.Keyboard.isPressed()) {
-                    Keyboard_Class::KeysState status = M5Cardputer.Keyboard.keysState();
-
-                    // Check if any printable key was pressed
-                    for (auto key : status.word) {
-                        if (key >= 0x20 && key <= 0x7E) { // Printable ASCII
-                            current_question = "";
-                            current_question += (char)key;
-                            current_state = TEXT_INPUT;
-                            displayTextInput(current_question);
-                            break;
-                        }
-                    }
-                }
-            }
-
-            // Check for button press to start voice input
-            if (M5Cardputer.BtnA.wasPressed()) {
-                // Single press - voice input
-                current_state = VOICE_INPUT;
-                rec_record_idx = 2;
-                draw_record_idx = 0;
-                M5Cardputer.Mic.begin();
-                state_timer = millis();
-                displayVoiceInput(0);
-            }
+        case IDLE:
+            updateIdlePower();
             break;
-        }
 
         case TEXT_INPUT: {
-            // Handle keyboard input
-            if (M5Cardputer.Keyboard.isChange()) {
-                if (M5Cardputer.Keyboard.isPressed()) {
-                    Keyboard_Class::KeysState status = M5Cardputer.Keyboard.keysState();
-
-                    // Handle special keys
-                    if (status.del && current_question.length() > 0) {
-                        current_question.remove(current_question.length() - 1);
-                        displayTextInput(current_question);
-                    } else if (status.enter) {
-                        // Submit question
-                        if (current_question.length() > 0) {
-                            uint32_t seed = generateSeedFromText(current_question);
-                            current_response_idx = selectResponse(seed);
-                            current_state = THINKING;
-                            state_timer = millis();
-                            displayThinking();
-                        }
-                    } else {
-                        // Add printable characters
-                        for (auto key : status.word) {
-                            if (key >= 0x20 && key <= 0x7E) { // Printable ASCII
-                                current_question += (char)key;
-                                displayTextInput(current_question);
-                            }
-                        }
-                    }
-                }
-            }
-
-            // Check for button A press (submit)
-            if (M5Cardputer.BtnA.wasPressed()) {
-                if (current_question.length() > 0) {
-                    uint32_t seed = generateSeedFromText(current_question);
-                    current_response_idx = selectResponse(seed);
-                    current_state = THINKING;
-                    state_timer = millis();
-                    displayThinking();
-                }
+            // Edits are applied to the question immediately but repainted at
+            // the frame rate, so fast typing never waits on the display
+            if (question_dirty && frameDue()) {
+                question_dirty = false;
+                updateTextInput(current_question);
+                noteKeyShown();
             }
             break;
         }
 
         case VOICE_INPUT: {
-            // Record audio for 2 seconds
-            if (M5Cardputer.Mic.isEnabled()) {
-                if (M5Cardputer.Mic.record(rec_data, record_length, record_samplerate)) {
-                    if (rec_record_idx < record_number) {
-                        rec_record_idx++;
-                        draw_record_idx = rec_record_idx - 2;
-
-                        // Update progress
-                        int progress = (rec_record_idx * 100) / record_number;
-                        displayVoiceInput(progress);
-                    } else {
-                        // Recording complete
-                        M5Cardputer.Mic.end();
-
-                        // Generate seed from audio
-                        uint32_t seed = generateSeedFromAudio(rec_data, record_size);
-                        current_response_idx = selectResponse(seed);
-
-                        current_state = THINKING;
-                        state_timer = millis();
-                        displayThinking();
-                    }
-                }
+            // audio_task records for up to 2 seconds, VAD ends it early on
+            // silence; the seed comes from the features it gathered
+            if (voice_capture_done) {
+                beginThinking(voice_seed);
+            } else if (frameDue()) {
+                updateVoiceInput(voice_progress);
             }
             break;
         }
 
         case THINKING: {
-            // Show thinking animation for 2 seconds
-            displayThinking(); // Update animation
+            // Show thinking animation for 2 seconds while audio_task
+            // pre-reads the answer's assets, longer if it had to wait for
+            // the catalog
+            if (!answer_chosen && catalog_status == CATALOG_READY) {
+                chooseAnswer();
+            }
+            if (frameDue()) {
+                displayThinking(); // Update animation
+            }
 
-            if (millis() - state_timer > 2000) {
+            if (answer_chosen && millis() - state_timer > 2000) {
+                sendAudioCommand(AUDIO_FINISH_PREFETCH);
+                waitForAudioEvent(AUDIO_PREFETCH_DONE);
                 current_state = SHOWING_ANSWER;
                 state_timer = millis();
-                audio_played = false; // Reset audio flag
-                displayAnswer(current_response_idx);
+
+                // Start the prefetched clip as the animation ends, not after
+                // the bitmap is decoded and pushed; the bitmap is claimed
+                // first because playback hands the cache to audio_task
+                AnswerBitmap bitmap;
+                takeAnswerBitmap(current_response_idx, bitmap);
+                audio_busy = true;
+                sendAudioCommand(AUDIO_PLAY, current_response_idx);
+                displayAnswer(current_response_idx, bitmap);
             }
             break;
         }
 
         case SHOWING_ANSWER: {
-            // Play audio on first entry to this state
-            if (!audio_played) {
-                audio_played = true;
-                playResponseAudio(responses[current_response_idx].wav_path);
-                state_timer = millis(); // Reset timer after audio completes
+            // Auto-return timer starts once the clip has finished
+            if (audio_busy) {
+                state_timer = millis();
             }
 
-            // Wait for button press or auto-return after 5 seconds
-            if (M5Cardputer.BtnA.wasPressed() || (millis() - state_timer > 5000)) {
-                current_state = IDLE;
-                current_question = "";
-                audio_played = false;
-                displayIdle();
+            // BtnA (handled as an input event) skips, otherwise auto-return
+            // after 5 seconds
+            if (millis() - state_timer > 5000) {
+                returnToIdle();
             }
             break;
         }
     }
 
-    delay(10);  // Small delay to prevent tight loop
+    waitForNextPoll();
 }
-
-
-
@@ -0,0 +1,180 @@
+/*
+ * Host stand-in for the parts of the Arduino-ESP32 core main.cpp uses, so
+ * the firmware compiles natively for the benchmarks in test/. Header-only:
+ * every test includes src/main.cpp once and nothing else links against it.
+ *
+ * Timing is real (steady_clock), memory is plain malloc, and FreeRTOS is
+ * reduced to stubs: tasks are never started, so anything main.cpp runs on
+ * audio_task or input_task has to be called directly.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef bool boolean;
+
+namespace native_hal {
+inline std::chrono::steady_clock::time_point boot_time = std::chrono::steady_clock::now();
+}
+
+inline unsigned long millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                 native_hal::boot_time).count();
+}
+
+inline unsigned long micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                 native_hal::boot_time).count();
+}
+
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void yield() {}
+
+// Arduino String, backed by std::string. Only what main.cpp uses.
+class String : public std::string {
+public:
+    String() {}
+    String(const char* s) : std::string(s ? s : "") {}
+    String(const std::string& s) : std::string(s) {}
+    explicit String(char c) : std::string(1, c) {}
+    bool isEmpty() const { return empty(); }
+    void remove(size_t index) { erase(std::min(index, size())); }
+    void remove(size_t index, size_t count) { erase(std::min(index, size()), count); }
+    String substring(size_t from) const { return from < size() ? String(substr(from)) : String(); }
+    String substring(size_t from, size_t to) const { return from < size() ? String(substr(from, to - from)) : String(); }
+    String& operator+=(char c) { push_back(c); return *this; }
+    String& operator+=(const char* s) { append(s ? s : ""); return *this; }
+    String& operator+=(const String& s) { append(s); return *this; }
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size-- && write(*buffer++)) n++;
+        return n;
+    }
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+};
+
+// Stream without the timeout: reads at the end of the data fail at once,
+// which is how a file behaves on the device anyway
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    size_t readBytes(char* buffer, size_t length) {
+        size_t n = 0;
+        for (int c; n < length && (c = read()) >= 0; n++) buffer[n] = (char)c;
+        return n;
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+    bool find(const char* target) { return findUntil(target, nullptr); }
+
+    // True once target has been read, false at the end of the stream or
+    // after terminator (if given) turns up first
+    bool findUntil(const char* target, const char* terminator) {
+        size_t target_len = strlen(target);
+        size_t term_len = terminator ? strlen(terminator) : 0;
+        size_t matched = 0, term_matched = 0;
+        for (int c; (c = read()) >= 0;) {
+            matched = c == target[matched] ? matched + 1 : (c == target[0] ? 1 : 0);
+            if (matched == target_len) return true;
+            if (term_len) {
+                term_matched = c == terminator[term_matched] ? term_matched + 1 : (c == terminator[0] ? 1 : 0);
+                if (term_matched == term_len) return false;
+            }
+        }
+        return false;
+    }
+};
+
+struct HardwareSerial : public Stream {
+    void begin(unsigned long) {}
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+    using Print::write;
+};
+inline HardwareSerial Serial;
+
+// Heap: capabilities are ignored, there is no PSRAM
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT  (1 << 12)
+
+inline bool psramFound() { return false; }
+
+// Cycle counter at a nominal 240MHz, derived from steady_clock; the heap
+// figures are made up, nothing on the host tracks them
+struct EspClass {
+    uint32_t getCycleCount() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                    native_hal::boot_time).count() * 240 / 1000;
+    }
+    uint32_t getCpuFreqMHz() { return 240; }
+    uint32_t getFreeHeap() { return 256 * 1024; }
+    uint32_t getMaxAllocHeap() { return 128 * 1024; }
+    uint32_t getFreePsram() { return 0; }
+};
+inline EspClass ESP;
+inline void* heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+inline void* heap_caps_realloc(void* ptr, size_t size, uint32_t) { return realloc(ptr, size); }
+inline void heap_caps_free(void* ptr) { free(ptr); }
+
+// FreeRTOS: one tick per millisecond, no scheduler
+typedef void* TaskHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+#define pdPASS   1
+#define pdTRUE   1
+#define pdFALSE  0
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMAX_DELAY 0xFFFFFFFFu
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*)(void*), const char*, uint32_t, void*, UBaseType_t,
+                                          TaskHandle_t* handle, BaseType_t) {
+    if (handle) *handle = nullptr;
+    return pdPASS;
+}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+inline void vTaskDelete(TaskHandle_t) {}
+inline BaseType_t xPortGetCoreID() { return 1; }
+inline TickType_t xTaskGetTickCount() { return (TickType_t)millis(); }
+inline void vTaskDelay(TickType_t ticks) { delay(ticks); }
+
+inline void vTaskDelayUntil(TickType_t* last_wake, TickType_t period) {
+    *last_wake += period;
+    long wait = (long)(*last_wake - xTaskGetTickCount());
+    if (wait > 0) delay(wait);
+}
+
+// Notifications never arrive, so a timed wait just sleeps
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t ticks) {
+    if (ticks != portMAX_DELAY) delay(ticks);
+    return 0;
+}
+inline BaseType_t xTaskNotifyGive(TaskHandle_t) { return pdPASS; }
@@ -0,0 +1,191 @@
+/*
+ * Host stand-in for M5Cardputer/M5GFX. Drawing is a no-op apart from the
+ * sprite buffers, which are really allocated. Text is measured with a
+ * made-up proportional font (narrow, normal and wide glyphs), close enough
+ * to FreeSansBoldOblique12pt7b for word wrap to take a realistic path.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+
+namespace lgfx {
+struct IFont {
+    uint8_t advance;  // Width of a normal glyph at text size 1
+    uint8_t height;
+};
+struct GFXfont : IFont {};
+struct rgb565_t { uint16_t raw; };
+struct swap565_t { uint8_t hi, lo; };
+}
+
+namespace fonts {
+inline constexpr lgfx::IFont Font0 = {6, 8};
+inline constexpr lgfx::GFXfont FreeSansBoldOblique12pt7b = {{14, 29}};
+}
+
+enum textdatum_t { top_left, top_center, top_right, middle_left, middle_center, middle_right,
+                   bottom_left, bottom_center, bottom_right };
+
+static constexpr uint16_t BLACK = 0x0000, WHITE = 0xFFFF, RED = 0xF800, GREEN = 0x07E0,
+                          YELLOW = 0xFFE0, CYAN = 0x07FF, MAGENTA = 0xF81F;
+
+class LovyanGFX : public Print {
+public:
+    LovyanGFX(int32_t width = 0, int32_t height = 0) : width_(width), height_(height) {}
+
+    int32_t width() const { return width_; }
+    int32_t height() const { return height_; }
+
+    void setFont(const lgfx::IFont* font) { font_ = font; }
+    const lgfx::IFont* getFont() const { return font_; }
+    void setTextSize(float size) { text_size_ = size; }
+    float getTextSizeX() const { return text_size_; }
+    void setTextDatum(textdatum_t) {}
+    void setTextColor(uint32_t) {}
+    void setTextColor(uint32_t, uint32_t) {}
+
+    int32_t glyphWidth(uint8_t c) const {
+        int32_t advance = font_->advance;
+        if (strchr("ijl.,;:'!| ", c)) advance /= 2;
+        else if (strchr("mwMW@", c)) advance += advance / 2;
+        return advance * text_size_;
+    }
+    int32_t textWidth(const char* text) {
+        int32_t width = 0;
+        while (*text) width += glyphWidth(*text++);
+        return width;
+    }
+    int32_t textWidth(const String& text) { return textWidth(text.c_str()); }
+    int32_t fontHeight() { return font_->height * text_size_; }
+
+    size_t drawString(const char* text, int32_t, int32_t) { return textWidth(text); }
+    size_t drawString(const String& text, int32_t x, int32_t y) { return drawString(text.c_str(), x, y); }
+    void setCursor(int32_t x, int32_t y) { cursor_x_ = x; cursor_y_ = y; }
+    int32_t getCursorX() const { return cursor_x_; }
+    int32_t getCursorY() const { return cursor_y_; }
+    size_t write(uint8_t c) override { cursor_x_ += glyphWidth(c); return 1; }
+    using Print::write;
+
+    void clear() {}
+    void fillScreen(uint32_t) {}
+    void drawPixel(int32_t, int32_t, uint32_t) {}
+    void drawFastVLine(int32_t, int32_t, int32_t, uint32_t) {}
+    void drawFastHLine(int32_t, int32_t, int32_t, uint32_t) {}
+    void drawLine(int32_t, int32_t, int32_t, int32_t, uint32_t) {}
+    void drawRect(int32_t, int32_t, int32_t, int32_t, uint32_t) {}
+    void fillRect(int32_t, int32_t, int32_t, int32_t, uint32_t) {}
+    void drawCircle(int32_t, int32_t, int32_t, uint32_t) {}
+    void fillCircle(int32_t, int32_t, int32_t, uint32_t) {}
+    void setClipRect(int32_t, int32_t, int32_t, int32_t) {}
+    void clearClipRect() {}
+    void pushImage(int32_t, int32_t, int32_t, int32_t, const lgfx::rgb565_t*) {}
+    void pushImage(int32_t, int32_t, int32_t, int32_t, const lgfx::swap565_t*) {}
+    void pushImageDMA(int32_t, int32_t, int32_t, int32_t, const lgfx::swap565_t*) {}
+    void waitDMA() {}
+    void startWrite() {}
+    void endWrite() {}
+    void setRotation(uint8_t) {}
+    void setBrightness(uint8_t brightness) { brightness_ = brightness; }
+    uint8_t getBrightness() const { return brightness_; }
+
+protected:
+    int32_t width_;
+    int32_t height_;
+    const lgfx::IFont* font_ = &fonts::Font0;
+    float text_size_ = 1;
+    int32_t cursor_x_ = 0;
+    int32_t cursor_y_ = 0;
+    uint8_t brightness_ = 127;
+};
+
+// The panel, already in landscape
+class M5GFX : public LovyanGFX {
+public:
+    M5GFX() : LovyanGFX(240, 135) {}
+};
+
+class LGFX_Sprite : public LovyanGFX {
+public:
+    explicit LGFX_Sprite(LovyanGFX*) {}
+    ~LGFX_Sprite() { deleteSprite(); }
+
+    void setColorDepth(int bits) { bits_ = bits; }
+    void* createSprite(int32_t width, int32_t height) {
+        deleteSprite();
+        buffer_ = calloc(width * height, (bits_ + 7) / 8);
+        if (buffer_) {
+            width_ = width;
+            height_ = height;
+        }
+        return buffer_;
+    }
+    void deleteSprite() {
+        free(buffer_);
+        buffer_ = nullptr;
+        width_ = height_ = 0;
+    }
+    void* getBuffer() { return buffer_; }
+    void pushSprite(int32_t, int32_t) {}
+
+private:
+    int bits_ = 16;
+    void* buffer_ = nullptr;
+};
+typedef LGFX_Sprite M5Canvas;
+
+struct Button_Class {
+    bool wasPressed() { return false; }
+};
+
+class Keyboard_Class {
+public:
+    struct KeysState {
+        std::vector<char> word;
+        bool ctrl = false;
+        bool del = false;
+        bool enter = false;
+    };
+    bool isChange() { return false; }
+    uint8_t isPressed() { return 0; }
+    KeysState keysState() { return KeysState(); }
+};
+
+// Playback finishes instantly, recording returns silence
+struct Speaker_Class {
+    bool begin() { return true; }
+    void end() {}
+    void setVolume(uint8_t) {}
+    bool playRaw(const int16_t*, size_t, uint32_t = 44100, bool = false, uint32_t = 1, int = -1, bool = false) {
+        return true;
+    }
+    size_t isPlaying(uint8_t) const { return 0; }
+    void stop(uint8_t) {}
+};
+
+struct Mic_Class {
+    bool begin() { return true; }
+    void end() {}
+    size_t isRecording() const { return 0; }
+    bool record(int16_t* buffer, size_t length, uint32_t, bool = false) {
+        memset(buffer, 0, length * sizeof(int16_t));
+        return true;
+    }
+};
+
+struct M5Config {};
+struct M5Unified {
+    M5Config config() { return M5Config(); }
+};
+inline M5Unified M5;
+
+struct M5CardputerClass {
+    void begin(M5Config, bool = true) {}
+    void update() {}
+    M5GFX Display;
+    Button_Class BtnA;
+    Speaker_Class Speaker;
+    Mic_Class Mic;
+    Keyboard_Class Keyboard;
+};
+inline M5CardputerClass M5Cardputer;
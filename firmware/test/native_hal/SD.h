@@ -0,0 +1,125 @@
+/*
+ * Host stand-in for the Arduino-ESP32 SD library. Card paths map onto a
+ * directory, native_hal::sd_root, which a test points at its own scratch
+ * copy of the card before calling into main.cpp.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+namespace native_hal {
+inline std::string sd_root = ".";
+
+inline std::string hostPath(const char* path) {
+    return sd_root + (path[0] == '/' ? "" : "/") + path;
+}
+}
+
+class File : public Stream {
+public:
+    File() {}
+    File(FILE* fp, const std::string& path) : impl_(std::make_shared<Impl>(fp, path)) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        return *this ? fwrite(buffer, 1, size, impl_->fp) : 0;
+    }
+    using Print::write;
+
+    int read() override { return *this ? fgetc(impl_->fp) : -1; }
+    size_t read(uint8_t* buffer, size_t size) { return *this ? fread(buffer, 1, size, impl_->fp) : 0; }
+    int peek() override {
+        if (!*this) return -1;
+        int c = fgetc(impl_->fp);
+        if (c != EOF) ungetc(c, impl_->fp);
+        return c;
+    }
+    int available() override { return *this ? (int)(size() - position()) : 0; }
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) {
+        return *this && fseek(impl_->fp, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+    }
+    size_t position() const { return *this ? ftell(impl_->fp) : 0; }
+    size_t size() const {
+        if (!*this) return 0;
+        fflush(impl_->fp);
+        struct stat st;
+        return fstat(fileno(impl_->fp), &st) == 0 ? st.st_size : 0;
+    }
+    time_t getLastWrite() {
+        struct stat st;
+        return *this && stat(impl_->path.c_str(), &st) == 0 ? st.st_mtime : 0;
+    }
+    void flush() { if (*this) fflush(impl_->fp); }
+
+    // Copies share the handle, as on the device
+    void close() {
+        if (impl_ && impl_->fp) {
+            fclose(impl_->fp);
+            impl_->fp = nullptr;
+        }
+        impl_.reset();
+    }
+    operator bool() const { return impl_ && impl_->fp; }
+
+private:
+    struct Impl {
+        Impl(FILE* f, const std::string& p) : fp(f), path(p) {}
+        ~Impl() { if (fp) fclose(fp); }
+        FILE* fp;
+        std::string path;
+    };
+    std::shared_ptr<Impl> impl_;
+};
+
+typedef enum { CARD_NONE, CARD_MMC, CARD_SD, CARD_SDHC, CARD_UNKNOWN } sdcard_type_t;
+
+class SDFS {
+public:
+    bool begin(uint8_t ss, SPIClass& spi, uint32_t frequency = 4000000, const char* mount = "/sd",
+               uint8_t max_files = 5, bool format_if_empty = false) {
+        return true;
+    }
+    void end() {}
+    sdcard_type_t cardType() { return CARD_SDHC; }
+    uint64_t cardSize() { return 1ull << 32; }
+
+    File open(const char* path, const char* mode = FILE_READ, bool create = false) {
+        std::string host = native_hal::hostPath(path);
+        FILE* fp = fopen(host.c_str(), mode[0] == 'r' ? "rb" : mode[0] == 'a' ? "ab" : "wb");
+        return fp ? File(fp, host) : File();
+    }
+    File open(const String& path, const char* mode = FILE_READ, bool create = false) {
+        return open(path.c_str(), mode, create);
+    }
+    bool exists(const char* path) {
+        struct stat st;
+        return stat(native_hal::hostPath(path).c_str(), &st) == 0;
+    }
+    bool exists(const String& path) { return exists(path.c_str()); }
+    bool remove(const char* path) { return ::unlink(native_hal::hostPath(path).c_str()) == 0; }
+    bool rename(const char* from, const char* to) {
+        return ::rename(native_hal::hostPath(from).c_str(), native_hal::hostPath(to).c_str()) == 0;
+    }
+    bool mkdir(const char* path) { return ::mkdir(native_hal::hostPath(path).c_str(), 0755) == 0; }
+
+    // A blank MBR, enough for the clock probe
+    bool readRAW(uint8_t* buffer, uint32_t sector) {
+        memset(buffer, 0, 512);
+        buffer[510] = 0x55;
+        buffer[511] = 0xAA;
+        return true;
+    }
+};
+inline SDFS SD;
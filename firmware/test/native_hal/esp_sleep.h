@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for ESP-IDF's sleep API. The benchmarks never enter
+ * low-power IDLE, so a light sleep returns at once, as if the timer fired.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+typedef enum { ESP_SLEEP_WAKEUP_UNDEFINED = 0, ESP_SLEEP_WAKEUP_TIMER = 4, ESP_SLEEP_WAKEUP_GPIO = 7 }
+    esp_sleep_wakeup_cause_t;
+#define ESP_OK 0
+
+inline esp_err_t esp_sleep_enable_timer_wakeup(uint64_t) { return ESP_OK; }
+inline esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+inline esp_err_t esp_light_sleep_start() { return ESP_OK; }
+inline esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return ESP_SLEEP_WAKEUP_TIMER; }
@@ -0,0 +1,245 @@
+/*
+ * Host benchmarks for main.cpp's core logic, built against the fakes in
+ * test/native_hal:
+ *
+ *     pio test -e native -v
+ *
+ * Each case prints ns/op and heap allocations/op. Timings depend on the
+ * machine, so only allocation counts are asserted: they are exact, and a
+ * hot path that starts allocating fails here before anything is flashed.
+ */
+
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bench {
+bool counting = false;
+size_t allocations = 0;
+size_t allocated_bytes = 0;
+volatile uint32_t sink = 0;  // Keeps results alive
+
+inline void noteAllocation(size_t size) {
+    if (!counting) return;
+    allocations++;
+    allocated_bytes += size;
+}
+}
+
+// Every allocation (new, ArduinoJson, heap_caps_malloc) ends up in malloc,
+// so counting there catches all of them. Needs glibc's internal entry points.
+#if defined(__GLIBC__)
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size) noexcept {
+    bench::noteAllocation(size);
+    return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t count, size_t size) noexcept {
+    bench::noteAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+extern "C" void* realloc(void* ptr, size_t size) noexcept {
+    bench::noteAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+static constexpr bool allocations_counted = true;
+#else
+static constexpr bool allocations_counted = false;
+#endif
+
+// Silence main.cpp's printf logging while an operation runs
+struct QuietStdout {
+    int saved;
+    QuietStdout() {
+        fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    ~QuietStdout() {
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+};
+
+struct BenchResult {
+    size_t allocations;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+// Run op once to warm up, then time iterations of it. Nothing inside may
+// assert, or stdout stays silenced.
+template <typename Op>
+static BenchResult runBenchmark(const char* name, size_t iterations, Op op) {
+    std::chrono::steady_clock::duration elapsed;
+    {
+        QuietStdout quiet;
+        op(0);
+        bench::allocations = bench::allocated_bytes = 0;
+        bench::counting = true;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) op(i);
+        elapsed = std::chrono::steady_clock::now() - start;
+        bench::counting = false;
+    }
+
+    BenchResult r;
+    r.allocations = bench::allocations;
+    r.ns_per_op = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    r.allocs_per_op = (double)bench::allocations / iterations;
+    r.bytes_per_op = (double)bench::allocated_bytes / iterations;
+    if (allocations_counted) {
+        printf("%-24s %12.1f ns/op %10.2f allocs/op %12.1f B/op\n", name, r.ns_per_op, r.allocs_per_op,
+               r.bytes_per_op);
+    } else {
+        printf("%-24s %12.1f ns/op (allocations not counted on this libc)\n", name, r.ns_per_op);
+    }
+    return r;
+}
+
+static void assertNoAllocations(const BenchResult& r) {
+    if (allocations_counted) TEST_ASSERT_EQUAL_UINT32(0, r.allocations);
+}
+
+// A scratch copy of the card holding the default responses.json
+static char card_dir[] = "/tmp/m8b-bench-XXXXXX";
+
+static void loadDefaultCatalog() {
+    bool loaded;
+    {
+        QuietStdout quiet;
+        SD.remove(index_path);
+        loaded = loadResponsesFromSD();
+        buildAliasTable();
+    }
+    TEST_ASSERT_TRUE(loaded);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_seed_from_text() {
+    String question = "Will the demo work on the first try tomorrow?";
+    BenchResult r = runBenchmark("generateSeedFromText", 1000000, [&](size_t) {
+        bench::sink += generateSeedFromText(question);
+    });
+    assertNoAllocations(r);
+}
+
+void test_seed_from_audio() {
+    // Two seconds of a 440Hz tone with noise, analysed in record_length chunks
+    // as audio_task does
+    std::vector<int16_t> audio(record_size);
+    uint32_t noise = 12345;
+    for (size_t i = 0; i < audio.size(); i++) {
+        noise = noise * 1664525 + 1013904223;
+        audio[i] = (int16_t)(8000 * sin(2 * M_PI * 440 * i / record_samplerate)) + (int16_t)(noise >> 22) - 512;
+    }
+    BenchResult r = runBenchmark("generateSeedFromAudio", 200, [&](size_t) {
+        bench::sink += generateSeedFromAudio(audio.data(), audio.size());
+    });
+    assertNoAllocations(r);
+
+    r = runBenchmark("accumulateAudioFeatures", 100000, [&](size_t i) {
+        AudioFeatures features;
+        size_t chunk = i % record_number;
+        accumulateAudioFeatures(features, audio.data() + chunk * record_length, record_length);
+        bench::sink += features.peak;
+    });
+    assertNoAllocations(r);
+}
+
+void test_select_response() {
+    loadDefaultCatalog();
+    TEST_ASSERT_EQUAL(30, responses.size());
+
+    // Uneven weights so the alias columns are really split
+    for (size_t i = 0; i < responses.size(); i++) {
+        responses[i].weight = 1 + i % 4;
+    }
+    buildAliasTable();
+
+    uint32_t seed = 1;
+    uint16_t max_idx = 0;
+    BenchResult r = runBenchmark("selectResponse", 1000000, [&](size_t) {
+        seed = seed * 1664525 + 1013904223;
+        max_idx = std::max(max_idx, selectResponse(seed));
+    });
+    assertNoAllocations(r);
+    TEST_ASSERT_EQUAL(responses.size() - 1, max_idx);
+
+    r = runBenchmark("buildAliasTable", 10000, [&](size_t) { buildAliasTable(); });
+}
+
+void test_load_responses() {
+    // Parse responses.json and write the index, as on the first boot
+    bool loaded = true;
+    runBenchmark("loadResponsesFromSD", 200, [&](size_t) { loaded = loadResponsesFromSD() && loaded; });
+    TEST_ASSERT_TRUE(loaded);
+    TEST_ASSERT_EQUAL(30, responses.size());
+
+    // Later boots read the index instead
+    runBenchmark("loadResponsesFromIndex", 2000, [&](size_t) { loaded = loadResponsesFromIndex() && loaded; });
+    TEST_ASSERT_TRUE(loaded);
+    TEST_ASSERT_EQUAL(30, responses.size());
+}
+
+void test_text_layout() {
+    loadDefaultCatalog();
+    frame.setFont(&fonts::FreeSansBoldOblique12pt7b);
+    frame.setTextSize(1);
+    updateGlyphAdvances();
+
+    int max_width = frame.width() - 10;
+    TextLayout layout;
+    BenchResult r = runBenchmark("layoutText", 200000, [&](size_t i) {
+        layoutText(responses[i % responses.size()].text.c_str(), 5, max_width, layout);
+        bench::sink += layout.line_count;
+    });
+    assertNoAllocations(r);
+
+    // The longest default answer must still wrap onto several lines
+    layoutText("Have you tried turning it off and on again?", 5, max_width, layout);
+    TEST_ASSERT_TRUE(layout.line_count > 1);
+
+    r = runBenchmark("drawWrappedText", 200000, [&](size_t i) {
+        drawWrappedText(responses[i % responses.size()].text.c_str(), 5, 25, max_width, 15);
+    });
+    assertNoAllocations(r);
+}
+
+int main(int argc, char** argv) {
+    if (!mkdtemp(card_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    native_hal::sd_root = card_dir;
+    frame.createSprite(M5Cardputer.Display.width(), M5Cardputer.Display.height());
+    {
+        QuietStdout quiet;
+        generateDefaultConfig();
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_seed_from_text);
+    RUN_TEST(test_seed_from_audio);
+    RUN_TEST(test_select_response);
+    RUN_TEST(test_load_responses);
+    RUN_TEST(test_text_layout);
+    int failures = UNITY_END();
+
+    SD.remove("/responses.json");
+    SD.remove(index_path);
+    rmdir(card_dir);
+    return failures;
+}
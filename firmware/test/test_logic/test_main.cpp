@@ -0,0 +1,655 @@
+/*
+ * Host tests for main.cpp's decoding, catalog and layout logic, built
+ * against the fakes in test/native_hal:
+ *
+ *     pio test -e native -v
+ *
+ * Converted audio is checked against a plain reference decode written here,
+ * catalogs against what was written to the card, the alias table against
+ * the exact probability each column gives, and the incremental question
+ * wrap against a full re-wrap after every key.
+ */
+
+#include <unity.h>
+
+#include "../../src/main.cpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Silence main.cpp's printf logging while an operation runs. Nothing inside
+// may assert, or stdout stays silenced.
+struct QuietStdout {
+    int saved;
+    QuietStdout() {
+        fflush(stdout);
+        saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    ~QuietStdout() {
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+};
+
+// A scratch card, emptied of catalog files before each test
+static char card_dir[] = "/tmp/m8b-test-XXXXXX";
+
+static void writeCardFile(const char* path, const std::vector<uint8_t>& bytes) {
+    File file = SD.open(path, FILE_WRITE);
+    TEST_ASSERT_TRUE(file);
+    TEST_ASSERT_EQUAL(bytes.size(), file.write(bytes.data(), bytes.size()));
+    file.close();
+}
+
+static void writeCardFile(const char* path, const char* text) {
+    writeCardFile(path, std::vector<uint8_t>(text, text + strlen(text)));
+}
+
+static std::vector<uint8_t> readCardFile(const char* path) {
+    File file = SD.open(path, FILE_READ);
+    TEST_ASSERT_TRUE(file);
+    std::vector<uint8_t> bytes(file.size());
+    TEST_ASSERT_EQUAL(bytes.size(), file.read(bytes.data(), bytes.size()));
+    file.close();
+    return bytes;
+}
+
+static void putLE(std::vector<uint8_t>& out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) out.push_back(value >> (8 * i));
+}
+
+static void putChunk(std::vector<uint8_t>& out, const char* id, const std::vector<uint8_t>& body) {
+    out.insert(out.end(), id, id + 4);
+    putLE(out, body.size(), 4);
+    out.insert(out.end(), body.begin(), body.end());
+    if (body.size() & 1) out.push_back(0);
+}
+
+// A WAV holding data as-is. IMA-ADPCM gets the 20-byte fmt and a fact
+// chunk its encoders write; list_first puts an odd-sized LIST chunk ahead
+// of fmt, as some editors do.
+static std::vector<uint8_t> makeWav(uint16_t format, uint16_t channels, uint16_t bits, uint32_t rate,
+                                    uint16_t block_align, const std::vector<uint8_t>& data, bool list_first = false) {
+    std::vector<uint8_t> body = {'W', 'A', 'V', 'E'};
+    if (list_first) putChunk(body, "LIST", {'I', 'N', 'F', 'O', 'x'});
+
+    std::vector<uint8_t> fmt;
+    putLE(fmt, format, 2);
+    putLE(fmt, channels, 2);
+    putLE(fmt, rate, 4);
+    putLE(fmt, rate * block_align, 4);
+    putLE(fmt, block_align, 2);
+    putLE(fmt, bits, 2);
+    if (format == wave_format_ima_adpcm) {
+        putLE(fmt, 2, 2);
+        putLE(fmt, 1 + (block_align - 4 * channels) * 2 / channels, 2);
+    }
+    putChunk(body, "fmt ", fmt);
+    if (format == wave_format_ima_adpcm) putChunk(body, "fact", {0, 0, 0, 0});
+    putChunk(body, "data", data);
+
+    std::vector<uint8_t> wav = {'R', 'I', 'F', 'F'};
+    putLE(wav, body.size(), 4);
+    wav.insert(wav.end(), body.begin(), body.end());
+    return wav;
+}
+
+static uint32_t test_noise = 12345;
+static uint32_t nextNoise() {
+    test_noise = test_noise * 1664525 + 1013904223;
+    return test_noise >> 8;
+}
+
+static std::vector<uint8_t> randomBytes(size_t count) {
+    std::vector<uint8_t> bytes(count);
+    for (uint8_t& b : bytes) b = nextNoise();
+    return bytes;
+}
+
+// Reference decode of interleaved PCM to one mono frame per source frame
+static std::vector<double> referencePcmFrames(const std::vector<uint8_t>& data, int channels, int bits) {
+    std::vector<double> frames;
+    size_t frame_bytes = channels * bits / 8;
+    for (size_t pos = 0; pos + frame_bytes <= data.size(); pos += frame_bytes) {
+        double sum = 0;
+        for (int ch = 0; ch < channels; ch++) {
+            const uint8_t* p = &data[pos + ch * bits / 8];
+            sum += bits == 8 ? (p[0] - 128) * 256.0 : (double)(int16_t)(p[0] | p[1] << 8);
+        }
+        frames.push_back(sum / channels);
+    }
+    return frames;
+}
+
+// Reference IMA-ADPCM decode as the Microsoft spec lays the blocks out:
+// a 4-byte header per channel, then 4 bytes (8 samples, low nibble first)
+// of each channel in turn. A short last block decodes as far as it goes.
+static std::vector<double> referenceImaFrames(const std::vector<uint8_t>& data, int channels, size_t block_align) {
+    static const int index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+    std::vector<double> frames;
+    for (size_t block = 0; block < data.size(); block += block_align) {
+        size_t bytes = std::min(block_align, data.size() - block);
+        if (bytes < 4u * channels) break;
+        const uint8_t* p = &data[block];
+        size_t block_frames = 1 + (bytes - 4 * channels) / (4 * channels) * 8;
+        std::vector<std::vector<int>> decoded(channels);
+        for (int ch = 0; ch < channels; ch++) {
+            int predictor = (int16_t)(p[4 * ch] | p[4 * ch + 1] << 8);
+            int index = std::min<int>(p[4 * ch + 2], 88);
+            decoded[ch].push_back(predictor);
+            for (size_t n = 0; n + 1 < block_frames; n++) {
+                uint8_t byte = p[4 * channels * (1 + n / 8) + 4 * ch + (n % 8) / 2];
+                int nibble = n & 1 ? byte >> 4 : byte & 0x0F;
+                int step = ima_step_table[index];
+                int diff = step >> 3;
+                if (nibble & 4) diff += step;
+                if (nibble & 2) diff += step >> 1;
+                if (nibble & 1) diff += step >> 2;
+                predictor += nibble & 8 ? -diff : diff;
+                predictor = std::max(-32768, std::min(32767, predictor));
+                index = std::max(0, std::min(88, index + index_table[nibble]));
+                decoded[ch].push_back(predictor);
+            }
+        }
+        for (size_t f = 0; f < block_frames; f++) {
+            double sum = 0;
+            for (int ch = 0; ch < channels; ch++) sum += decoded[ch][f];
+            frames.push_back(sum / channels);
+        }
+    }
+    return frames;
+}
+
+// Resolve and convert a WAV on the card the way playback does, asking for
+// odd-sized runs so refills land part way through a request
+static std::vector<int16_t> convertWithFirmware(const char* path) {
+    AssetEntry asset;
+    bool resolved;
+    {
+        QuietStdout quiet;
+        resolved = resolveWavAsset(path, asset);
+    }
+    TEST_ASSERT_TRUE(resolved);
+
+    File file = openAssetFile(path);
+    TEST_ASSERT_TRUE(file);
+    file.seek(asset.pcm_offset);
+    WavConverter convert;
+    size_t bytes = startWavConverter(convert, asset);
+    TEST_ASSERT_TRUE(convert.active);
+
+    std::vector<int16_t> out(bytes / sizeof(int16_t) + 64);
+    size_t produced = 0;
+    size_t got;
+    while ((got = convertWavSamples(file, convert, out.data() + produced,
+                                    std::min<size_t>(97, out.size() - produced))) > 0) {
+        produced += got;
+    }
+    file.close();
+    TEST_ASSERT_EQUAL(bytes / sizeof(int16_t), produced);
+    out.resize(produced);
+    return out;
+}
+
+// Output sample k sits k * rate / record_samplerate frames into the source
+// (at the converter's 16.16 step) and is the straight line between the
+// frames either side. Rounding the stereo mix and the 15-bit fraction may
+// move it by a sample value plus one per 32768 of the gap between frames.
+static void assertResampled(const std::vector<int16_t>& out, const std::vector<double>& frames, uint32_t rate) {
+    uint64_t step = ((uint64_t)rate << 16) / record_samplerate;
+    size_t expected = frames.size() > 1 ? (((uint64_t)(frames.size() - 1) << 16) + step - 1) / step : 0;
+    TEST_ASSERT_EQUAL(expected, out.size());
+    for (size_t k = 0; k < out.size(); k++) {
+        uint64_t pos = k * step;
+        size_t i = pos >> 16;
+        double frac = (pos & 0xFFFF) / 65536.0;
+        double want = frames[i] + (frames[i + 1] - frames[i]) * frac;
+        double gap = fabs(frames[i + 1] - frames[i]);
+        TEST_ASSERT_FLOAT_WITHIN((float)(1.5 + gap / 32768), (float)want, (float)out[k]);
+    }
+}
+
+static void checkPcmConversion(const char* path, uint16_t channels, uint16_t bits, uint32_t rate, size_t frames,
+                               bool list_first = false) {
+    uint16_t block_align = channels * bits / 8;
+    std::vector<uint8_t> data = randomBytes(frames * block_align);
+    writeCardFile(path, makeWav(wave_format_pcm, channels, bits, rate, block_align, data, list_first));
+    assertResampled(convertWithFirmware(path), referencePcmFrames(data, channels, bits), rate);
+}
+
+static void checkImaConversion(const char* path, uint16_t channels, uint32_t rate, uint16_t block_align,
+                               size_t blocks) {
+    // Whole blocks of random nibbles plus a short one, each header with a
+    // valid predictor and step index
+    std::vector<uint8_t> data = randomBytes(blocks * block_align + 4 * channels + 8 * channels);
+    for (size_t block = 0; block < data.size(); block += block_align) {
+        for (int ch = 0; ch < channels; ch++) {
+            data[block + 4 * ch + 2] = nextNoise() % 89;
+            data[block + 4 * ch + 3] = 0;
+        }
+    }
+    writeCardFile(path, makeWav(wave_format_ima_adpcm, channels, 4, rate, block_align, data));
+    assertResampled(convertWithFirmware(path), referenceImaFrames(data, channels, block_align), rate);
+}
+
+void setUp() {
+    SD.remove(pack_path);
+    SD.remove(index_path);
+    assets_packed = false;
+}
+void tearDown() {}
+
+void test_convert_pcm() {
+    checkPcmConversion("/audio/u8.wav", 1, 8, record_samplerate, 3000);
+    checkPcmConversion("/audio/stereo.wav", 2, 16, record_samplerate, 3000);
+    checkPcmConversion("/audio/stereo_u8.wav", 2, 8, record_samplerate, 3000);
+}
+
+void test_convert_list_before_fmt() {
+    checkPcmConversion("/audio/list.wav", 2, 16, record_samplerate, 1500, true);
+
+    // The data chunk is found past the padded LIST chunk
+    AssetEntry asset;
+    TEST_ASSERT_TRUE(resolveWavAsset("/audio/list.wav", asset));
+    TEST_ASSERT_EQUAL(12 + 14 + 24 + 8, asset.pcm_offset);
+    TEST_ASSERT_EQUAL(1500 * 4, asset.pcm_bytes);
+}
+
+void test_convert_resampled() {
+    checkPcmConversion("/audio/22k.wav", 1, 16, 22050, 4000);
+    checkPcmConversion("/audio/8k.wav", 1, 16, 8000, 2000);
+    checkPcmConversion("/audio/44k_u8.wav", 2, 8, 44100, 5000);
+}
+
+void test_convert_ima_adpcm() {
+    checkImaConversion("/audio/ima.wav", 1, record_samplerate, 256, 12);
+    checkImaConversion("/audio/ima_stereo.wav", 2, 22050, 512, 8);
+}
+
+void test_wav_format_checks() {
+    TEST_ASSERT_TRUE(wavFormatSupported(wave_format_pcm, 2, 16, 44100, 4));
+    TEST_ASSERT_TRUE(wavFormatSupported(wave_format_ima_adpcm, 1, 4, 16000, 256));
+    TEST_ASSERT_FALSE(wavFormatSupported(wave_format_pcm, 3, 16, 16000, 6));
+    TEST_ASSERT_FALSE(wavFormatSupported(wave_format_pcm, 1, 24, 16000, 3));
+    TEST_ASSERT_FALSE(wavFormatSupported(wave_format_pcm, 1, 16, 96000, 2));
+
+    // Header fields wider than a byte must not narrow into a supported format
+    TEST_ASSERT_FALSE(wavFormatSupported(wave_format_pcm, 257, 16, 16000, 2));
+    TEST_ASSERT_FALSE(wavFormatSupported(wave_format_pcm, 1, 272, 16000, 2));
+    writeCardFile("/audio/wide.wav", makeWav(wave_format_pcm, 257, 16, 16000, 2, randomBytes(64)));
+    AssetEntry asset;
+    bool resolved;
+    {
+        QuietStdout quiet;
+        resolved = resolveWavAsset("/audio/wide.wav", asset);
+    }
+    TEST_ASSERT_FALSE(resolved);
+    TEST_ASSERT_EQUAL(0, asset.pcm_bytes);
+}
+
+// A bottom-up 24bpp BMP of width x height random pixels
+static std::vector<uint8_t> makeBmp(int32_t width, int32_t height) {
+    size_t stride = (width * 3 + 3) & ~3;
+    std::vector<uint8_t> bmp = {'B', 'M'};
+    putLE(bmp, 54 + stride * height, 4);
+    putLE(bmp, 0, 4);
+    putLE(bmp, 54, 4);
+    putLE(bmp, 40, 4);
+    putLE(bmp, width, 4);
+    putLE(bmp, height, 4);
+    putLE(bmp, 1, 2);
+    putLE(bmp, 24, 2);
+    for (int i = 0; i < 6; i++) putLE(bmp, 0, 4);
+    std::vector<uint8_t> pixels = randomBytes(stride * height);
+    bmp.insert(bmp.end(), pixels.begin(), pixels.end());
+    return bmp;
+}
+
+struct CatalogSnapshot {
+    std::vector<std::string> text, wav, bitmap;
+    std::vector<float> weight;
+    std::vector<AssetEntry> assets;
+};
+
+static CatalogSnapshot snapshotCatalog() {
+    CatalogSnapshot s;
+    for (const Response& r : responses) {
+        s.text.push_back(r.text.c_str());
+        s.wav.push_back(r.wav_path.c_str());
+        s.bitmap.push_back(r.bitmap_path.c_str());
+        s.weight.push_back(r.weight);
+    }
+    s.assets = catalog_assets;
+    return s;
+}
+
+static void assertCatalogMatches(const CatalogSnapshot& s) {
+    TEST_ASSERT_EQUAL(s.text.size(), responses.size());
+    TEST_ASSERT_EQUAL(s.text.size(), catalog_assets.size());
+    for (size_t i = 0; i < responses.size(); i++) {
+        TEST_ASSERT_EQUAL_STRING(s.text[i].c_str(), responses[i].text.c_str());
+        TEST_ASSERT_EQUAL_STRING(s.wav[i].c_str(), responses[i].wav_path.c_str());
+        TEST_ASSERT_EQUAL_STRING(s.bitmap[i].c_str(), responses[i].bitmap_path.c_str());
+        TEST_ASSERT_EQUAL_FLOAT(s.weight[i], responses[i].weight);
+
+        const AssetEntry& a = s.assets[i];
+        const AssetEntry& b = catalog_assets[i];
+        TEST_ASSERT_EQUAL(a.pcm_offset, b.pcm_offset);
+        TEST_ASSERT_EQUAL(a.pcm_bytes, b.pcm_bytes);
+        TEST_ASSERT_EQUAL(a.sample_rate, b.sample_rate);
+        TEST_ASSERT_EQUAL(a.audio_format, b.audio_format);
+        TEST_ASSERT_EQUAL(a.channels, b.channels);
+        TEST_ASSERT_EQUAL(a.bits_per_sample, b.bits_per_sample);
+        TEST_ASSERT_EQUAL(a.block_align, b.block_align);
+        TEST_ASSERT_EQUAL(a.pixels_offset, b.pixels_offset);
+        TEST_ASSERT_EQUAL(a.width, b.width);
+        TEST_ASSERT_EQUAL(a.height, b.height);
+        TEST_ASSERT_EQUAL(a.bpp, b.bpp);
+        TEST_ASSERT_EQUAL(a.pixel_flags, b.pixel_flags);
+    }
+}
+
+static bool quietly(bool (*load)()) {
+    QuietStdout quiet;
+    return load();
+}
+
+static void writeTestCatalogJson() {
+    writeCardFile("/audio/answer.wav", makeWav(wave_format_pcm, 1, 8, 8000, 1, randomBytes(801)));
+    writeCardFile("/images/answer.bmp", makeBmp(3, 2));
+    writeCardFile("/responses.json",
+                  "[{\"text\": \"One\", \"wav\": \"audio/answer.wav\", \"bitmap\": \"/images/answer.bmp\", "
+                  "\"weight\": 2.5},\n"
+                  " {\"text\": \"Two\", \"wav\": \"/audio/answer.wav\", \"weight\": 0},\n"
+                  " {\"text\": \"\"},\n"
+                  " {\"text\": \"Three\", \"bitmap\": \"images/answer.bmp\", \"weight\": -1, \"extra\": [1, 2]},\n"
+                  " {\"text\": \"Four\", \"wav\": \"audio/missing.wav\"}]");
+}
+
+void test_json_index_round_trip() {
+    writeTestCatalogJson();
+    TEST_ASSERT_TRUE(quietly(loadResponsesFromSD));
+    TEST_ASSERT_EQUAL(4, responses.size());
+    TEST_ASSERT_EQUAL_STRING("Three", responses[2].text.c_str());
+
+    // Both spellings of a path intern to one leading-slash string
+    TEST_ASSERT_EQUAL_STRING("/audio/answer.wav", responses[0].wav_path.c_str());
+    TEST_ASSERT_EQUAL(responses[0].wav_path.offset, responses[1].wav_path.offset);
+    TEST_ASSERT_EQUAL(responses[0].bitmap_path.offset, responses[2].bitmap_path.offset);
+
+    TEST_ASSERT_EQUAL_FLOAT(2.5f, responses[0].weight);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, responses[1].weight);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, responses[2].weight);
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, responses[3].weight);
+
+    TEST_ASSERT_EQUAL(8000, catalog_assets[0].sample_rate);
+    TEST_ASSERT_EQUAL(801, catalog_assets[0].pcm_bytes);
+    TEST_ASSERT_EQUAL(8, catalog_assets[0].bits_per_sample);
+    TEST_ASSERT_EQUAL(3, catalog_assets[0].width);
+    TEST_ASSERT_EQUAL(2, catalog_assets[0].height);
+    TEST_ASSERT_EQUAL(24, catalog_assets[0].bpp);
+    TEST_ASSERT_EQUAL(54, catalog_assets[0].pixels_offset);
+    TEST_ASSERT_EQUAL(0, catalog_assets[2].pcm_bytes);
+    TEST_ASSERT_EQUAL(0, catalog_assets[3].pcm_bytes);
+
+    // The index written alongside reloads to the same catalog
+    CatalogSnapshot parsed = snapshotCatalog();
+    TEST_ASSERT_TRUE(SD.exists(index_path));
+    responses.clear();
+    catalog_assets.clear();
+    TEST_ASSERT_TRUE(quietly(loadResponsesFromIndex));
+    assertCatalogMatches(parsed);
+
+    // Editing the JSON makes the index stale
+    writeCardFile("/responses.json", "[{\"text\": \"Changed\"}]");
+    TEST_ASSERT_FALSE(quietly(loadResponsesFromIndex));
+}
+
+// Load responses.idx after patching bytes of it
+static bool loadPatchedIndex(const std::vector<uint8_t>& index, size_t at, const std::vector<uint8_t>& patch) {
+    std::vector<uint8_t> bytes = index;
+    std::copy(patch.begin(), patch.end(), bytes.begin() + at);
+    writeCardFile(index_path, bytes);
+    return quietly(loadResponsesFromIndex);
+}
+
+void test_index_rejects_bad_fields() {
+    writeTestCatalogJson();
+    TEST_ASSERT_TRUE(quietly(loadResponsesFromSD));
+    std::vector<uint8_t> index = readCardFile(index_path);
+    std::vector<uint8_t> patch;
+
+    // Sizes that don't fit in the file are refused before anything is allocated
+    putLE(patch, 0xFFFFFFF0, 4);
+    TEST_ASSERT_FALSE(loadPatchedIndex(index, 12, patch));
+    TEST_ASSERT_FALSE(loadPatchedIndex(index, 8, patch));
+    patch.clear();
+    putLE(patch, 60000, 2);
+    TEST_ASSERT_FALSE(loadPatchedIndex(index, 6, patch));
+
+    // A bitmap without a drawable bpp is dropped, the response kept
+    size_t entry0 = catalog_header_bytes;
+    TEST_ASSERT_TRUE(loadPatchedIndex(index, entry0 + 14, {0}));
+    TEST_ASSERT_EQUAL(4, responses.size());
+    TEST_ASSERT_EQUAL(0, catalog_assets[0].width);
+    BmpInfo info;
+    File file;
+    TEST_ASSERT_FALSE(openResponseBitmap(0, file, info));
+    TEST_ASSERT_TRUE(loadPatchedIndex(index, entry0 + 14, {8}));
+    TEST_ASSERT_EQUAL(0, catalog_assets[0].width);
+
+    // Weights that aren't finite and non-negative are never picked
+    uint32_t inf_bits = 0x7F800000;
+    patch.clear();
+    putLE(patch, inf_bits, 4);
+    TEST_ASSERT_TRUE(loadPatchedIndex(index, entry0 + 32, patch));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, responses[0].weight);
+    patch.clear();
+    putLE(patch, 0x7FC00000, 4);  // NaN
+    TEST_ASSERT_TRUE(loadPatchedIndex(index, entry0 + 32, patch));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, responses[0].weight);
+}
+
+// One packed response laid out as tools/pack_assets.py writes it
+void test_pack_loading() {
+    const char strings[] = "\0Packed answer\0/audio/p.wav\0/images/p.bmp";
+    std::vector<uint8_t> blob(strings, strings + sizeof(strings));
+    std::vector<uint8_t> pcm = randomBytes(64);
+    std::vector<uint8_t> pixels = randomBytes(2 * 3 * 2);  // 2x3 RGB565, already 4-byte rows
+
+    uint32_t strings_offset = catalog_header_bytes + catalog_entry_bytes;
+    uint32_t pcm_offset = (strings_offset + blob.size() + 3) & ~3;
+    uint32_t pixels_offset = pcm_offset + pcm.size();
+    std::vector<uint8_t> pack;
+    putLE(pack, pack_magic, 4);
+    putLE(pack, catalog_version, 2);
+    putLE(pack, 1, 2);
+    putLE(pack, strings_offset, 4);
+    putLE(pack, blob.size(), 4);
+    putLE(pack, 0, 4);
+    putLE(pack, 0, 4);
+    putLE(pack, 1, 4);   // text
+    putLE(pack, 15, 4);  // wav
+    putLE(pack, 28, 4);  // bitmap
+    putLE(pack, record_samplerate, 2);
+    pack.push_back(16);
+    pack.push_back(pixel_top_down);
+    putLE(pack, pcm_offset, 4);
+    putLE(pack, pcm.size(), 4);
+    putLE(pack, pixels_offset, 4);
+    putLE(pack, 2, 2);
+    putLE(pack, 3, 2);
+    putLE(pack, 0x40400000, 4);  // 3.0f
+    putLE(pack, wave_format_pcm, 2);
+    pack.push_back(1);
+    pack.push_back(16);
+    putLE(pack, 2, 2);
+    pack.insert(pack.end(), blob.begin(), blob.end());
+    pack.resize(pcm_offset);
+    pack.insert(pack.end(), pcm.begin(), pcm.end());
+    pack.insert(pack.end(), pixels.begin(), pixels.end());
+    writeCardFile(pack_path, pack);
+
+    TEST_ASSERT_TRUE(quietly(loadResponsesFromPack));
+    TEST_ASSERT_TRUE(assets_packed);
+    TEST_ASSERT_EQUAL(1, responses.size());
+    TEST_ASSERT_EQUAL_STRING("Packed answer", responses[0].text.c_str());
+    TEST_ASSERT_EQUAL_STRING("/audio/p.wav", responses[0].wav_path.c_str());
+    TEST_ASSERT_EQUAL_STRING("/images/p.bmp", responses[0].bitmap_path.c_str());
+    TEST_ASSERT_EQUAL_FLOAT(3.0f, responses[0].weight);
+
+    // Both assets are read out of the pack itself
+    File file;
+    size_t bytes = 0;
+    WavConverter convert;
+    TEST_ASSERT_TRUE(openResponseAudio(0, file, bytes, convert));
+    TEST_ASSERT_FALSE(convert.active);
+    TEST_ASSERT_EQUAL(pcm.size(), bytes);
+    std::vector<uint8_t> read(bytes);
+    TEST_ASSERT_EQUAL(bytes, file.read(read.data(), bytes));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(pcm.data(), read.data(), bytes);
+    file.close();
+
+    BmpInfo info;
+    TEST_ASSERT_TRUE(openResponseBitmap(0, file, info));
+    TEST_ASSERT_TRUE(info.top_down);
+    TEST_ASSERT_EQUAL(4, info.row_stride);
+    read.resize(pixels.size());
+    TEST_ASSERT_EQUAL(pixels.size(), file.read(read.data(), read.size()));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(pixels.data(), read.data(), pixels.size());
+    file.close();
+}
+
+// Exact chance of each response under the alias table: column c is hit
+// with 1/n, then keeps itself for fractions below its threshold
+static std::vector<double> aliasProbabilities() {
+    size_t n = responses.size();
+    std::vector<double> p(n, 0.0);
+    for (size_t c = 0; c < n; c++) {
+        double keep = alias_threshold[c] / 4294967296.0;
+        p[c] += keep / n;
+        p[alias_index[c]] += (1.0 - keep) / n;
+    }
+    return p;
+}
+
+static void setWeights(const std::vector<float>& weights) {
+    responses.assign(weights.size(), Response());
+    for (size_t i = 0; i < weights.size(); i++) responses[i].weight = weights[i];
+    {
+        QuietStdout quiet;
+        buildAliasTable();
+    }
+}
+
+static void assertAliasMatchesWeights(double tolerance) {
+    double total = 0;
+    for (const Response& r : responses) total += r.weight;
+    std::vector<double> p = aliasProbabilities();
+    for (size_t i = 0; i < responses.size(); i++) {
+        if (responses[i].weight == 0.0f) {
+            TEST_ASSERT_TRUE_MESSAGE(p[i] == 0.0, "weight-0 response is selectable");
+        } else {
+            TEST_ASSERT_TRUE(fabs(p[i] - responses[i].weight / total) <= tolerance * responses[i].weight / total);
+        }
+    }
+}
+
+void test_alias_distribution() {
+    setWeights({1, 0, 3, 0.5f, 0, 6, 1, 1});
+    assertAliasMatchesWeights(1e-6);
+
+    // Seeds spread over the whole range never land on a weight-0 response
+    std::vector<size_t> hits(responses.size(), 0);
+    for (uint32_t i = 0; i < 100000; i++) hits[selectResponse(i * 42949u + (i >> 3))]++;
+    TEST_ASSERT_EQUAL(0, hits[1]);
+    TEST_ASSERT_EQUAL(0, hits[4]);
+    TEST_ASSERT_TRUE(hits[5] > hits[2]);
+
+    // Nothing positive falls back to a uniform pick
+    setWeights({0, 0, 0});
+    std::vector<double> p = aliasProbabilities();
+    for (double q : p) TEST_ASSERT_TRUE(fabs(q - 1.0 / 3) < 1e-9);
+}
+
+void test_alias_large_skewed_catalog() {
+    // One heavy response among tens of thousands of light or empty ones:
+    // rounding must neither strand columns nor leak into weight 0
+    std::vector<float> weights(max_responses);
+    for (size_t i = 0; i < weights.size(); i++) weights[i] = i % 2 ? 0.01f : 0.0f;
+    weights[12345] = 1000.0f;
+    setWeights(weights);
+    assertAliasMatchesWeights(1e-6);
+    setWeights({});
+}
+
+// Apply one key to the question (backspace as '\b') the way the text input
+// screen does, then check the incremental re-wrap against a full one
+static void editQuestion(String& question, char key) {
+    if (key == '\b') {
+        if (question.length() > 0) question.remove(question.length() - 1);
+    } else {
+        question += key;
+    }
+    updateTextInput(question);
+
+    std::vector<uint16_t> lines = question_lines;
+    int cursor_x = question_cursor_x;
+    int cursor_y = question_cursor_y;
+    question_lines.clear();
+    layoutQuestionFrom(question, 0);
+    TEST_ASSERT_TRUE_MESSAGE(lines == question_lines, question.c_str());
+    TEST_ASSERT_EQUAL_MESSAGE(question_cursor_x, cursor_x, question.c_str());
+    TEST_ASSERT_EQUAL_MESSAGE(question_cursor_y, cursor_y, question.c_str());
+    TEST_ASSERT_TRUE_MESSAGE(cursor_x + frame.textWidth("_") <= frame.width() - 10, question.c_str());
+}
+
+void test_question_wrap() {
+    frame.setFont(&fonts::FreeSansBoldOblique12pt7b);
+    frame.setTextSize(1);
+
+    // A trailing space past the edge, then a newline, then backspace
+    String question;
+    displayTextInput(question);
+    for (const char* key = "l,arwWrWlgwxyor.m \n\b"; *key; key++) editQuestion(question, *key);
+
+    // Random typing with backspaces mixed in
+    const char keys[] = "lWwxyor.m,ag  \n\b\b\b";
+    for (int session = 0; session < 2000; session++) {
+        question = "";
+        displayTextInput(question);
+        for (int k = 0; k < 60; k++) editQuestion(question, keys[nextNoise() % (sizeof(keys) - 1)]);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (!mkdtemp(card_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    native_hal::sd_root = card_dir;
+    SD.mkdir("/audio");
+    SD.mkdir("/images");
+    frame.createSprite(M5Cardputer.Display.width(), M5Cardputer.Display.height());
+
+    UNITY_BEGIN();
+    RUN_TEST(test_convert_pcm);
+    RUN_TEST(test_convert_list_before_fmt);
+    RUN_TEST(test_convert_resampled);
+    RUN_TEST(test_convert_ima_adpcm);
+    RUN_TEST(test_wav_format_checks);
+    RUN_TEST(test_json_index_round_trip);
+    RUN_TEST(test_index_rejects_bad_fields);
+    RUN_TEST(test_pack_loading);
+    RUN_TEST(test_alias_distribution);
+    RUN_TEST(test_alias_large_skewed_catalog);
+    RUN_TEST(test_question_wrap);
+    int failures = UNITY_END();
+
+    std::string cleanup = std::string("rm -rf ") + card_dir;
+    return system(cleanup.c_str()) == 0 ? failures : 1;
+}
@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+"""Pack responses.json and its WAV/BMP assets into a single responses.pak.
+
+The firmware prefers /responses.pak over /responses.json when both are on
+the SD card, so re-run this after editing responses or their assets:
+
+    python3 tools/pack_assets.py /path/to/sdcard
+
+Layout (little-endian, shared with responses.idx; see the AssetEntry comment
+in firmware/src/main.cpp):
+
+    header  "M8BP", u16 version, u16 count, u32 strings_offset, u32 strings_bytes,
+            u32 source_size, u32 source_mtime (both 0 for a pack)
+    entry   u32 text, u32 wav, u32 bitmap (offsets into the strings blob),
+            u16 sample_rate, u8 bpp, u8 pixel_flags,
+            u32 pcm_offset, u32 pcm_bytes, u32 pixels_offset, u16 width, u16 height,
+            f32 weight, u16 audio_format, u8 channels, u8 bits_per_sample,
+            u16 block_align
+    strings NUL-terminated strings, starting with an empty one at offset 0;
+            identical paths are stored once
+    data    16-bit mono PCM, or IMA-ADPCM blocks copied as they are, at the
+            clip's own rate (no WAV header; the firmware decodes and
+            resamples) and top-down RGB565 pixels, rows padded to 4 bytes;
+            responses sharing a file share its data
+"""
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+PACK_MAGIC = b"M8BP"
+PACK_VERSION = 6
+HEADER = struct.Struct("<4sHHIIII")
+ENTRY = struct.Struct("<IIIHBBIIIHHfHBBH")
+MAX_RESPONSES = 0xFFFF
+PIXEL_TOP_DOWN = 0x01
+WAVE_FORMAT_PCM = 1
+WAVE_FORMAT_IMA_ADPCM = 0x11
+MAX_ADPCM_BLOCK = 2048  # wav_raw_bytes in the firmware
+MAX_ROW_BYTES = 4096  # bmp_chunk_bytes in the firmware
+
+
+def read_wav(path):
+    """Return (sample_rate, format, channels, bits, block_align, data).
+
+    PCM comes back as 16-bit mono, downmixed and widened; IMA-ADPCM is left
+    encoded for the firmware to decode.
+    """
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[0:4] != b"RIFF" or data[8:12] != b"WAVE":
+        raise ValueError("not a RIFF/WAVE file")
+
+    fmt = None
+    pcm = None
+    pos = 12
+    while pos + 8 <= len(data):
+        chunk_id, size = struct.unpack_from("<4sI", data, pos)
+        body = data[pos + 8:pos + 8 + size]
+        if chunk_id == b"fmt ":
+            fmt = struct.unpack_from("<HHIIHH", body)
+        elif chunk_id == b"data":
+            pcm = body
+        pos += 8 + size + (size & 1)
+
+    if fmt is None or pcm is None:
+        raise ValueError("missing fmt or data chunk")
+    audio_format, channels, rate, _, block_align, bits = fmt
+    if not 0 < rate <= 0xFFFF:
+        raise ValueError("unsupported sample rate %d" % rate)
+    if audio_format == WAVE_FORMAT_IMA_ADPCM and bits == 4 and channels in (1, 2):
+        if not 4 * channels < block_align <= MAX_ADPCM_BLOCK:
+            raise ValueError("ADPCM block size %d not supported" % block_align)
+        return rate, audio_format, channels, bits, block_align, pcm
+    if audio_format != WAVE_FORMAT_PCM or bits not in (8, 16) or channels not in (1, 2):
+        raise ValueError("need 8 or 16-bit PCM or 4-bit IMA-ADPCM, mono or stereo "
+                         "(got format %d, %d-bit, %d ch)" % (audio_format, bits, channels))
+
+    width = bits // 8
+    pcm = pcm[:len(pcm) - len(pcm) % (width * channels)]
+    if bits == 8:
+        samples = [(b - 128) * 256 for b in pcm]
+    else:
+        samples = struct.unpack("<%dh" % (len(pcm) // 2), pcm)
+    if channels == 2:
+        samples = [(samples[i] + samples[i + 1]) >> 1 for i in range(0, len(samples), 2)]
+    return rate, WAVE_FORMAT_PCM, 1, 16, 2, struct.pack("<%dh" % len(samples), *samples)
+
+
+def read_bmp(path):
+    """Return (width, height, top-down RGB565 rows) for 16/24-bit BMPs."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[0:2] != b"BM":
+        raise ValueError("not a BMP file")
+
+    data_offset, = struct.unpack_from("<I", data, 10)
+    dib_size, width, height, _, bpp, compression = struct.unpack_from("<IiiHHI", data, 14)
+    top_down = height < 0
+    height = abs(height)
+    if bpp == 24 and compression == 0:
+        rgb555 = False
+    elif bpp == 16 and compression in (0, 3):
+        rgb555 = True
+        if compression == 3 and len(data) >= 62:
+            rgb555 = struct.unpack_from("<I", data, 58)[0] != 0x07E0
+    else:
+        raise ValueError("unsupported BMP (%d bpp, compression %d)" % (bpp, compression))
+    if width <= 0 or height == 0 or width * 2 > MAX_ROW_BYTES:
+        raise ValueError("unsupported size %dx%d" % (width, height))
+
+    stride = (width * bpp + 31) // 32 * 4
+    out = bytearray()
+    for y in range(height):
+        row = y if top_down else height - 1 - y
+        start = data_offset + row * stride
+        for x in range(width):
+            if bpp == 24:
+                b, g, r = data[start + x * 3:start + x * 3 + 3]
+                v = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3)
+            else:
+                v, = struct.unpack_from("<H", data, start + x * 2)
+                if rgb555:
+                    g = (v >> 5) & 0x1F
+                    v = ((v & 0x7C00) << 1) | (((g << 1) | (g >> 4)) << 5) | (v & 0x1F)
+            out += struct.pack("<H", v)
+        out += b"\0" * (-(width * 2) % 4)
+    return width, height, bytes(out)
+
+
+def resolve(root, path):
+    return os.path.join(root, path.lstrip("/"))
+
+
+def catalog_path(path):
+    # Leading slash added as internCatalogPath() does, so both spellings of a
+    # path share one string and one copy of its asset
+    return "/" + path.lstrip("/") if path else ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("sd_root", help="directory holding responses.json and the asset folders")
+    parser.add_argument("-o", "--output", help="output file (default: <sd_root>/responses.pak)")
+    args = parser.parse_args()
+
+    with open(os.path.join(args.sd_root, "responses.json"), encoding="utf-8") as f:
+        responses = [r for r in json.load(f) if r.get("text")]
+    if not 0 < len(responses) <= MAX_RESPONSES:
+        sys.exit("responses.json must hold 1-%d responses with text" % MAX_RESPONSES)
+
+    strings = bytearray(b"\0")
+    interned = {"": 0}
+    blobs = bytearray()
+    audio = {}
+    images = {}
+    entries = []
+
+    def add_string(text, intern=False):
+        if intern and text in interned:
+            return interned[text]
+        offset = len(strings)
+        strings.extend(text.encode("utf-8") + b"\0")
+        if intern:
+            interned[text] = offset
+        return offset
+
+    for i, r in enumerate(responses):
+        wav = catalog_path(r.get("wav", ""))
+        bitmap = catalog_path(r.get("bitmap", ""))
+        entry = {"text": add_string(r["text"]), "wav": add_string(wav, True), "bitmap": add_string(bitmap, True),
+                 "weight": max(float(r.get("weight", 1.0)), 0.0),
+                 "rate": 0, "format": 0, "channels": 0, "bits": 0, "block_align": 0,
+                 "pcm": 0, "pcm_bytes": 0, "pixels": 0, "width": 0, "height": 0}
+
+        if wav and wav not in audio:
+            try:
+                rate, fmt, channels, bits, block_align, pcm = read_wav(resolve(args.sd_root, wav))
+                blobs += b"\0" * (len(blobs) & 1)
+                audio[wav] = {"rate": rate, "format": fmt, "channels": channels, "bits": bits,
+                              "block_align": block_align, "pcm": len(blobs), "pcm_bytes": len(pcm)}
+                blobs += pcm
+            except (OSError, ValueError) as e:
+                print("warning: skipping audio for response %d (%s): %s" % (i, wav, e))
+                audio[wav] = {}
+        entry.update(audio.get(wav, {}))
+
+        if bitmap and bitmap not in images:
+            try:
+                width, height, pixels = read_bmp(resolve(args.sd_root, bitmap))
+                blobs += b"\0" * (-len(blobs) % 4)
+                images[bitmap] = {"pixels": len(blobs), "width": width, "height": height}
+                blobs += pixels
+            except (OSError, ValueError) as e:
+                print("warning: skipping bitmap for response %d (%s): %s" % (i, bitmap, e))
+                images[bitmap] = {}
+        entry.update(images.get(bitmap, {}))
+
+        entries.append(entry)
+
+    # Header, entry table, strings, then 4-byte aligned asset data
+    strings_offset = HEADER.size + ENTRY.size * len(entries)
+    data_offset = (strings_offset + len(strings) + 3) & ~3
+    out = bytearray(HEADER.pack(PACK_MAGIC, PACK_VERSION, len(entries), strings_offset, len(strings), 0, 0))
+    for e in entries:
+        out += ENTRY.pack(e["text"], e["wav"], e["bitmap"], e["rate"],
+                          16 if e["width"] else 0, PIXEL_TOP_DOWN if e["width"] else 0,
+                          data_offset + e["pcm"] if e["pcm_bytes"] else 0, e["pcm_bytes"],
+                          data_offset + e["pixels"] if e["width"] else 0, e["width"], e["height"],
+                          e["weight"], e["format"], e["channels"], e["bits"], e["block_align"])
+    out += strings
+    out += b"\0" * (data_offset - len(out))
+    out += blobs
+
+    output = args.output or os.path.join(args.sd_root, "responses.pak")
+    with open(output, "wb") as f:
+        f.write(out)
+    print("Packed %d responses into %s (%d bytes)" % (len(entries), output, len(out)))
+
+
+if __name__ == "__main__":
+    main()